@@ -0,0 +1,343 @@
+// Writes the bundle archive described in Replete/bundle_format.h.
+//
+// Built and run by script/bundle:
+//
+//   bundle_pack <archive> <gzip|zstd|none> <dict|-> <out-dir|-> < index
+//
+// Each index line is "path<TAB>compressed-file<TAB>uncompressed-length",
+// optionally followed by "<TAB>utf16" for text stored as UTF-16LE. Given
+// the compiler's output directory, the dependency graph in its main.js
+// and goog/deps.js is written into the archive as well.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../Replete/bundle_format.h"
+#include "../../../Replete/goog_deps.h"
+
+struct pack_entry {
+    char *path;
+    char *blob_path;
+    uint32_t len;
+    uint32_t compressed_len;
+    uint32_t flags;
+};
+
+struct pack_provide {
+    const char *name;
+    uint32_t dep;
+};
+
+// Strings and the dependency index are assembled in memory before writing.
+struct buffer {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+static void die(const char *message, const char *detail) {
+    fprintf(stderr, "bundle_pack: %s %s\n", message, detail ? detail : "");
+    exit(1);
+}
+
+static uint64_t buffer_append(struct buffer *buffer, const void *data, size_t len) {
+    if (buffer->len + len > buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (buffer->len + len > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) {
+            die("out of memory", NULL);
+        }
+    }
+    uint64_t offset = buffer->len;
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return offset;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct pack_entry *) a)->path, ((const struct pack_entry *) b)->path);
+}
+
+static uint64_t align(uint64_t offset) {
+    return (offset + BUNDLE_ALIGN - 1) & ~(uint64_t) (BUNDLE_ALIGN - 1);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const struct pack_provide *) a)->name, ((const struct pack_provide *) b)->name);
+}
+
+static int compare_provides(const void *a, const void *b) {
+    const struct pack_provide *pa = a;
+    const struct pack_provide *pb = b;
+    int cmp = strcmp(pa->name, pb->name);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return pa->dep < pb->dep ? -1 : pa->dep > pb->dep;
+}
+
+static char *read_file(const char *dir, const char *path) {
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s/%s", dir, path);
+    FILE *f = fopen(full_path, "rb");
+    if (!f) {
+        die("cannot open", full_path);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    if (fread(text, 1, size, f) != (size_t) size) {
+        die("cannot read", full_path);
+    }
+    fclose(f);
+    text[size] = '\0';
+    return text;
+}
+
+// Builds the dependency index described in bundle_format.h, with its
+// offsets relative to base, where it will be written.
+static void build_deps_index(struct buffer *out, const char *dir, uint64_t base) {
+    struct goog_deps deps;
+    memset(&deps, 0, sizeof(deps));
+    char *text = read_file(dir, "goog/deps.js");
+    goog_deps_parse(&deps, text);
+    free(text);
+    text = read_file(dir, "main.js");
+    goog_deps_parse(&deps, text);
+    free(text);
+
+    size_t provide_count = 0;
+    size_t i, j;
+    for (i = 0; i < deps.count; i++) {
+        provide_count += deps.deps[i].provides_count;
+    }
+    struct pack_provide *provides = malloc((provide_count ? provide_count : 1) * sizeof(struct pack_provide));
+    size_t n = 0;
+    for (i = 0; i < deps.count; i++) {
+        for (j = 0; j < deps.deps[i].provides_count; j++) {
+            provides[n].name = deps.deps[i].provides[j];
+            provides[n].dep = (uint32_t) i;
+            n++;
+        }
+    }
+    // Where two files provide the same namespace, the first parsed wins,
+    // as in goog_deps_closure.
+    qsort(provides, n, sizeof(struct pack_provide), compare_provides);
+    provide_count = 0;
+    for (i = 0; i < n; i++) {
+        if (provide_count == 0 || strcmp(provides[provide_count - 1].name, provides[i].name) != 0) {
+            provides[provide_count++] = provides[i];
+        }
+    }
+
+    struct buffer strings = {NULL, 0, 0};
+    struct buffer requires = {NULL, 0, 0};
+    struct bundle_dep *index_deps = calloc(deps.count ? deps.count : 1, sizeof(struct bundle_dep));
+    for (i = 0; i < deps.count; i++) {
+        struct goog_dependency *dep = &deps.deps[i];
+        index_deps[i].path_offset = (uint32_t) buffer_append(&strings, dep->path, strlen(dep->path) + 1);
+        index_deps[i].requires_index = (uint32_t) (requires.len / sizeof(uint32_t));
+        index_deps[i].flags = dep->module ? BUNDLE_DEP_MODULE : 0;
+        for (j = 0; j < dep->requires_count; j++) {
+            struct pack_provide key = {dep->requires[j], 0};
+            struct pack_provide *found = bsearch(&key, provides, provide_count, sizeof(struct pack_provide), compare_names);
+            if (found) {
+                buffer_append(&requires, &found->dep, sizeof(uint32_t));
+                index_deps[i].requires_count++;
+            }
+        }
+    }
+
+    uint32_t slot_count = 16;
+    while (slot_count < provide_count * 2) {
+        slot_count *= 2;
+    }
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    struct bundle_provide *index_provides = calloc(provide_count ? provide_count : 1, sizeof(struct bundle_provide));
+    for (i = 0; i < provide_count; i++) {
+        index_provides[i].name_offset = (uint32_t) buffer_append(&strings, provides[i].name, strlen(provides[i].name) + 1);
+        index_provides[i].dep = provides[i].dep;
+        uint32_t slot = bundle_hash_name(provides[i].name) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t) i + 1;
+    }
+
+    struct bundle_deps_header header;
+    memset(&header, 0, sizeof(header));
+    header.dep_count = (uint32_t) deps.count;
+    header.require_count = (uint32_t) (requires.len / sizeof(uint32_t));
+    header.slot_count = slot_count;
+    header.provide_count = (uint32_t) provide_count;
+
+    buffer_append(out, &header, sizeof(header));
+    header.deps_offset = base + buffer_append(out, index_deps, deps.count * sizeof(struct bundle_dep));
+    header.requires_offset = base + buffer_append(out, requires.data, requires.len);
+    header.slots_offset = base + buffer_append(out, slots, slot_count * sizeof(uint32_t));
+    header.provides_offset = base + buffer_append(out, index_provides, provide_count * sizeof(struct bundle_provide));
+    header.strings_offset = base + buffer_append(out, strings.data, strings.len);
+    memcpy(out->data, &header, sizeof(header));
+
+    free(index_provides);
+    free(slots);
+    free(index_deps);
+    free(requires.data);
+    free(strings.data);
+    free(provides);
+    goog_deps_free(&deps);
+}
+
+static long file_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        die("cannot open", path);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void pad_to(FILE *out, uint64_t offset) {
+    while ((uint64_t) ftell(out) < offset) {
+        fputc(0, out);
+    }
+}
+
+static void copy_file_to(FILE *out, const char *path) {
+    char buf[65536];
+    size_t n;
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        die("cannot open", path);
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            die("write failed", NULL);
+        }
+    }
+    fclose(in);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        fprintf(stderr, "%s <archive> <gzip|zstd|none> <dict|-> <out-dir|-> < index\n", argv[0]);
+        exit(1);
+    }
+
+    uint32_t codec;
+    if (strcmp(argv[2], "gzip") == 0) {
+        codec = BUNDLE_CODEC_ID_GZIP;
+    } else if (strcmp(argv[2], "zstd") == 0) {
+        codec = BUNDLE_CODEC_ID_ZSTD;
+    } else if (strcmp(argv[2], "none") == 0) {
+        codec = BUNDLE_CODEC_ID_NONE;
+    } else {
+        die("unknown codec", argv[2]);
+    }
+    const char *dict_path = strcmp(argv[3], "-") == 0 ? NULL : argv[3];
+    const char *deps_dir = strcmp(argv[4], "-") == 0 ? NULL : argv[4];
+
+    size_t capacity = 1024;
+    size_t count = 0;
+    struct pack_entry *entries = malloc(capacity * sizeof(struct pack_entry));
+
+    char line[8192];
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *path = strtok(line, "\t");
+        char *blob_path = strtok(NULL, "\t");
+        char *len = strtok(NULL, "\t");
+        char *encoding = strtok(NULL, "\t");
+        if (!path || !blob_path || !len) {
+            die("malformed index line", line);
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(struct pack_entry));
+        }
+        entries[count].path = strdup(path);
+        entries[count].blob_path = strdup(blob_path);
+        entries[count].len = (uint32_t) strtoul(len, NULL, 10);
+        entries[count].compressed_len = (uint32_t) file_size(blob_path);
+        entries[count].flags = encoding && strcmp(encoding, "utf16") == 0 ? BUNDLE_ENTRY_UTF16 : 0;
+        count++;
+    }
+
+    qsort(entries, count, sizeof(struct pack_entry), compare_entries);
+
+    struct bundle_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_FORMAT_VERSION;
+    header.codec = codec;
+    header.entry_count = (uint32_t) count;
+    header.entries_offset = sizeof(struct bundle_header);
+    header.paths_offset = header.entries_offset + count * sizeof(struct bundle_archive_entry);
+
+    uint64_t paths_len = 0;
+    size_t i;
+    for (i = 0; i < count; i++) {
+        paths_len += strlen(entries[i].path) + 1;
+    }
+
+    uint64_t offset = align(header.paths_offset + paths_len);
+    if (dict_path) {
+        header.dict_offset = offset;
+        header.dict_len = (uint64_t) file_size(dict_path);
+        offset = align(offset + header.dict_len);
+    }
+    struct buffer deps_index = {NULL, 0, 0};
+    if (deps_dir) {
+        header.deps_offset = offset;
+        build_deps_index(&deps_index, deps_dir, offset);
+        header.deps_len = deps_index.len;
+        offset = align(offset + header.deps_len);
+    }
+
+    struct bundle_archive_entry *archive_entries = calloc(count, sizeof(struct bundle_archive_entry));
+    uint32_t path_offset = 0;
+    for (i = 0; i < count; i++) {
+        archive_entries[i].path_offset = path_offset;
+        archive_entries[i].path_len = (uint32_t) strlen(entries[i].path);
+        archive_entries[i].data_offset = offset;
+        archive_entries[i].compressed_len = entries[i].compressed_len;
+        archive_entries[i].len = entries[i].len;
+        archive_entries[i].flags = entries[i].flags;
+        path_offset += archive_entries[i].path_len + 1;
+        offset = align(offset + entries[i].compressed_len);
+    }
+
+    FILE *out = fopen(argv[1], "wb");
+    if (!out) {
+        die("cannot create", argv[1]);
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(archive_entries, sizeof(struct bundle_archive_entry), count, out);
+    for (i = 0; i < count; i++) {
+        fwrite(entries[i].path, 1, strlen(entries[i].path) + 1, out);
+    }
+    if (dict_path) {
+        pad_to(out, header.dict_offset);
+        copy_file_to(out, dict_path);
+    }
+    if (deps_dir) {
+        pad_to(out, header.deps_offset);
+        fwrite(deps_index.data, 1, deps_index.len, out);
+    }
+    for (i = 0; i < count; i++) {
+        pad_to(out, archive_entries[i].data_offset);
+        copy_file_to(out, entries[i].blob_path);
+    }
+    if (fclose(out) != 0) {
+        die("write failed", argv[1]);
+    }
+
+    return 0;
+}
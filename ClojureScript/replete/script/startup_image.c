@@ -0,0 +1,130 @@
+// Writes the startup image: every file that requiring the given namespaces
+// loads, concatenated in load order into a single script, so bootstrap()
+// can evaluate them in one JSEvaluateScript call instead of one import per
+// file.
+//
+// Built and run by script/bundle:
+//
+//   startup_image <dir> [-x <namespace>]... <namespace>... > image.js
+//
+// Files that a -x namespace loads are left out, for an image evaluated
+// after one that already has them.
+//
+// The dependency graph is read from <dir>/goog/deps.js and <dir>/main.js.
+// goog.module files are wrapped in goog.loadModule, the way the debug
+// loader evaluates them. After each file comes a REPLETE_STARTUP_LOADED
+// call (defined by bootstrap()) marking its namespaces as loaded, so goog
+// won't import that file again, and if the image fails partway through
+// a later goog.require picks up from there.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../Replete/goog_deps.h"
+
+static char *read_file(const char *dir, const char *path) {
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s/%s", dir, path);
+    FILE *f = fopen(full_path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    if (fread(text, 1, size, f) != (size_t) size) {
+        fclose(f);
+        free(text);
+        return NULL;
+    }
+    fclose(f);
+    text[size] = '\0';
+    return text;
+}
+
+static void read_deps(struct goog_deps *deps, const char *dir, const char *path) {
+    char *text = read_file(dir, path);
+    if (!text) {
+        fprintf(stderr, "startup_image: cannot read %s/%s\n", dir, path);
+        exit(1);
+    }
+    goog_deps_parse(deps, text);
+    free(text);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "%s <dir> [-x <namespace>]... <namespace>... > image.js\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+    }
+
+    const char **excluded = malloc(argc * sizeof(char *));
+    size_t excluded_count = 0;
+    int arg = 2;
+    while (arg + 1 < argc && strcmp(argv[arg], "-x") == 0) {
+        excluded[excluded_count++] = argv[arg + 1];
+        arg += 2;
+    }
+    if (arg >= argc) {
+        usage(argv[0]);
+    }
+
+    struct goog_deps deps;
+    memset(&deps, 0, sizeof(deps));
+    read_deps(&deps, argv[1], "goog/deps.js");
+    read_deps(&deps, argv[1], "main.js");
+
+    size_t count = 0;
+    size_t *order = goog_deps_closure(&deps, (const char **) argv + arg, argc - arg, &count);
+    size_t skip_count = 0;
+    size_t *skip = goog_deps_closure(&deps, excluded, excluded_count, &skip_count);
+    bool *skipped = calloc(deps.count ? deps.count : 1, sizeof(bool));
+    if (!order || !skip || !skipped) {
+        fprintf(stderr, "startup_image: out of memory\n");
+        exit(1);
+    }
+    size_t i, j;
+    for (i = 0; i < skip_count; i++) {
+        skipped[skip[i]] = true;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (skipped[order[i]]) {
+            continue;
+        }
+        struct goog_dependency *dep = &deps.deps[order[i]];
+        char *text = read_file(argv[1], dep->path);
+        if (!text) {
+            // Left for goog.require to load on its own, when something asks.
+            fprintf(stderr, "startup_image: %s not found, skipping\n", dep->path);
+            continue;
+        }
+
+        if (dep->module) {
+            printf("goog.loadModule(function(exports) {'use strict';%s\n;return exports;});\n", text);
+        } else {
+            printf("%s\n;", text);
+        }
+        free(text);
+
+        printf("REPLETE_STARTUP_LOADED([");
+        for (j = 0; j < dep->provides_count; j++) {
+            printf("%s'%s'", j ? "," : "", dep->provides[j]);
+        }
+        printf("]);\n");
+    }
+
+    free(order);
+    free(skip);
+    free(skipped);
+    free(excluded);
+    goog_deps_free(&deps);
+    return ferror(stdout) ? 1 : 0;
+}
@@ -16,6 +16,7 @@
 -(void)setPrintCallback:(void (^)(BOOL, NSString*))printCallback;
 -(void)evaluate:(NSString*)text;
 -(void)evaluate:(NSString*)text asExpression:(BOOL)expression;
+-(void)interruptEvaluation;
 -(NSArray*)parinferFormat:(NSString*)text pos:(int)pos enterPressed:(BOOL)enterPressed;
 -(NSString*)getClojureScriptVersion;
 
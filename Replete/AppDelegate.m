@@ -17,7 +17,14 @@
 #include "io.h"
 #include "file.h"
 #include "http.h"
+#include "http_cache.h"
 #include "bundle.h"
+#include "bundle_prefetch.h"
+#include "trace.h"
+#include "path_set.h"
+#include "timer.h"
+#include "js_thread.h"
+#include "watchdog.h"
 
 
 @interface AppDelegate ()
@@ -34,6 +41,8 @@
 @property NSString *codeToBeEvaluatedWhenReady;
 @property NSString *rootDirectory;
 @property NSString *caRootPath;
+@property CFAbsoluteTime launchTime;
+@property BOOL compilerLoaded;
 
 @end
 
@@ -41,6 +50,8 @@
 
 
 - (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions {
+    self.launchTime = CFAbsoluteTimeGetCurrent();
+    
     [[NSNotificationCenter defaultCenter] addObserver:self
                                              selector:@selector(handleDidChangeStatusBarOrientationNotification:)
                                                  name:UIApplicationDidChangeStatusBarOrientationNotification
@@ -52,6 +63,34 @@
     self.caRootPath = [[NSBundle mainBundle] pathForResource:@"cacert" ofType:@"pem"];
     set_ca_root_path([self.caRootPath cStringUsingEncoding:NSUTF8StringEncoding]);
     
+    // Responses to requests made with :cache true. Under Caches, so the
+    // system can reclaim the space and it isn't backed up.
+    NSString* cachesPath = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+    http_cache_open([[cachesPath stringByAppendingPathComponent:@"http"] fileSystemRepresentation],
+                    32 * 1024 * 1024);
+    
+    // Launch with -TraceStartup YES to record where startup time goes; the
+    // trace is written to startup-trace.json in the Documents directory
+    // once the compiler has loaded.
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:@"TraceStartup"]) {
+        trace_start();
+    }
+    
+    // Launch with -TimerSlackMillis N to coalesce timers due within N ms of
+    // each other into one batch.
+    if ([[NSUserDefaults standardUserDefaults] objectForKey:@"TimerSlackMillis"]) {
+        timer_set_slack([[NSUserDefaults standardUserDefaults] integerForKey:@"TimerSlackMillis"]);
+    }
+    
+    // Launch with -EvaluationTimeLimitSeconds N to stop evaluations and
+    // timer callbacks that run longer than N seconds; 0 lifts the limit.
+    if ([[NSUserDefaults standardUserDefaults] objectForKey:@"EvaluationTimeLimitSeconds"]) {
+        watchdog_set_limit([[NSUserDefaults standardUserDefaults] doubleForKey:@"EvaluationTimeLimitSeconds"]);
+    }
+    
+    NSString* bundlePath = [[NSBundle mainBundle] pathForResource:@"bundle" ofType:@"dat"];
+    bundle_open([bundlePath cStringUsingEncoding:NSUTF8StringEncoding]);
+    
     return YES;
 }
 
@@ -97,37 +136,171 @@ int str_has_prefix(const char *str, const char *prefix) {
     return strncmp(str, prefix, prefix_len);
 }
 
-unsigned long hash(unsigned char *str) {
-    unsigned long hash = 5381;
-    int c;
-    
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+// Paths of the scripts AMBLY_IMPORT_SCRIPT has loaded.
+static struct path_set loaded_scripts;
+
+JSGlobalContextRef ctx = NULL;
+
+// A bundled script as a string for JavaScriptCore, straight from its
+// UTF-16 form when it was bundled that way. NULL if path isn't in the
+// bundle.
+JSStringRef bundled_script_string(char *path) {
+    bundle_prefetch_claim(path);
+    
+    size_t length = 0;
+    bool mapped = false;
+    const unsigned short *chars = bundle_get_utf16(path, &length, &mapped);
+    if (chars != NULL) {
+        if (mapped) {
+            return utf16_to_string(chars, length);
+        }
+        // An inflated copy can be evicted and inflated again, so the
+        // string gets its own copy rather than pinning the cached one.
+        JSStringRef script_ref = JSStringCreateWithCharacters(chars, length);
+        bundle_release_contents((char *) chars);
+        return script_ref;
+    }
     
-    return hash;
+    // JavaScriptCore copies the text into the string, so the loader's
+    // buffer can be reused before evaluation starts any nested loads.
+    char *script = bundle_load_script(path);
+    if (script == NULL) {
+        return NULL;
+    }
+    JSStringRef script_ref = JSStringCreateWithUTF8CString(script);
+    bundle_done_script(script);
+    return script_ref;
+}
+
+// Returns false if path isn't in the bundle.
+bool evaluate_bundled_script(JSContextRef ctx, char *path, char *source) {
+    JSStringRef script_ref = bundled_script_string(path);
+    if (script_ref == NULL) {
+        return false;
+    }
+    evaluate_script_string(ctx, script_ref, source);
+    JSStringRelease(script_ref);
+    return true;
 }
 
-static unsigned long loaded_goog_hashes[2048];
-static size_t count_loaded_goog_hashes = 0;
+// goog.module files have to go through goog.loadModule rather than be
+// evaluated at the top level.
+bool load_bundled_module(JSContextRef ctx, char *path) {
+    JSStringRef script_ref = bundled_script_string(path);
+    if (script_ref == NULL) {
+        return false;
+    }
+    JSObjectRef global_obj = JSContextGetGlobalObject(ctx);
+    JSStringRef goog_str = JSStringCreateWithUTF8CString("goog");
+    JSObjectRef goog_obj = JSValueToObject(ctx, JSObjectGetProperty(ctx, global_obj, goog_str, NULL), NULL);
+    JSStringRelease(goog_str);
+    JSStringRef load_module_str = JSStringCreateWithUTF8CString("loadModule");
+    JSObjectRef load_module_fn = JSValueToObject(ctx, JSObjectGetProperty(ctx, goog_obj, load_module_str, NULL), NULL);
+    JSStringRelease(load_module_str);
+    
+    JSValueRef arguments[1];
+    arguments[0] = JSValueMakeString(ctx, script_ref);
+    JSStringRelease(script_ref);
+    JSValueRef ex = NULL;
+    JSObjectCallAsFunction(ctx, load_module_fn, goog_obj, 1, arguments, &ex);
+    debug_print_value("load_bundled_module", ctx, ex);
+    return true;
+}
+
+// With a dependency index in the bundle, goog.require is resolved here
+// instead of by goog's debug loader. Each dependency records the load
+// generation it was last evaluated in; "reload-all" starts a new one, so
+// everything the namespace requires is evaluated again exactly once.
+static uint32_t *dep_load_generation = NULL;
+static uint32_t load_generation = 1;
+
+static void ensure_dep_load_generations(void) {
+    if (dep_load_generation == NULL) {
+        dep_load_generation = calloc(bundle_deps_count(), sizeof(uint32_t));
+    }
+}
 
-bool is_loaded(unsigned long h) {
+static bool dep_is_loaded(int dep) {
+    return dep_load_generation[dep] != 0;
+}
+
+static bool dep_is_current(int dep) {
+    return dep_load_generation[dep] == load_generation;
+}
+
+JSValueRef function_require(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                            size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc < 1 || JSValueGetType(ctx, args[0]) != kJSTypeString) {
+        return JSValueMakeBoolean(ctx, false);
+    }
+    
+    char *ns = value_to_c_string(ctx, args[0]);
+    int dep = bundle_deps_find(ns);
+    if (dep < 0) {
+        free(ns);
+        return JSValueMakeBoolean(ctx, false);
+    }
+    TRACE_BEGIN("require", ns);
+    free(ns);
+    ensure_dep_load_generations();
+    
+    bool (*skip)(int dep) = dep_is_loaded;
+    if (argc > 1 && JSValueToBoolean(ctx, args[1])) {
+        char *reload = value_to_c_string(ctx, args[1]);
+        if (reload != NULL && strcmp(reload, "reload-all") == 0) {
+            load_generation++;
+            skip = dep_is_current;
+        } else {
+            dep_load_generation[dep] = 0;
+        }
+        free(reload);
+    }
+    
+    size_t count = 0;
+    int *order = bundle_deps_closure(&dep, 1, skip, &count);
     size_t i;
-    for (i = 0; i < count_loaded_goog_hashes; ++i) {
-        if (loaded_goog_hashes[i] == h) {
-            return true;
+    for (i = 0; i < count; i++) {
+        // A module loaded along the way may have required it already.
+        if (skip(order[i])) {
+            continue;
+        }
+        dep_load_generation[order[i]] = load_generation;
+        char *path = (char *) bundle_deps_path(order[i]);
+        TRACE_BEGIN("import", path);
+        bool loaded = bundle_deps_is_module(order[i]) ? load_bundled_module(ctx, path)
+                                                      : evaluate_bundled_script(ctx, path, path);
+        TRACE_END("import");
+        if (!loaded) {
+            NSLog(@"Failed to get source for %s", path);
         }
     }
-    return false;
+    free(order);
+    TRACE_END("require");
+    
+    return JSValueMakeBoolean(ctx, true);
 }
 
-void add_loaded_hash(unsigned long h) {
-    if (count_loaded_goog_hashes < 2048) {
-        loaded_goog_hashes[count_loaded_goog_hashes++] = h;
+// Called by the startup image after each file with the namespaces it
+// provides, so requiring them later doesn't evaluate the file again.
+JSValueRef function_startup_loaded(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                   size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueIsObject(ctx, args[0])) {
+        ensure_dep_load_generations();
+        JSObjectRef namespaces = JSValueToObject(ctx, args[0], NULL);
+        int count = array_get_count(ctx, namespaces);
+        int i;
+        for (i = 0; i < count; i++) {
+            char *ns = value_to_c_string(ctx, array_get_value_at_index(ctx, namespaces, i));
+            int dep = ns != NULL ? bundle_deps_find(ns) : -1;
+            if (dep >= 0) {
+                dep_load_generation[dep] = load_generation;
+            }
+            free(ns);
+        }
     }
+    return JSValueMakeUndefined(ctx);
 }
 
-JSGlobalContextRef ctx = NULL;
-
 JSValueRef function_import_script(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                   size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeString) {
@@ -143,38 +316,83 @@ JSValueRef function_import_script(JSContextRef ctx, JSObjectRef function, JSObje
         if (str_has_prefix(path, "goog/../") == 0) {
             path = path + 8;
         } else {
-            unsigned long h = hash((unsigned char *) path);
-            if (is_loaded(h)) {
+            if (!path_set_add(&loaded_scripts, path)) {
                 can_skip_load = true;
-            } else {
-                add_loaded_hash(h);
             }
         }
         
         if (!can_skip_load) {
-            char *source = bundle_get_contents(path);
-            if (source != NULL) {
-                evaluate_script(ctx, source, path);
-                free(source);
-            } else {
+            TRACE_BEGIN("import", path);
+            if (!evaluate_bundled_script(ctx, path, path)) {
                 NSLog(@"Failed to get source for %s", path);
             }
+            TRACE_END("import");
         }
     }
     
     return JSValueMakeUndefined(ctx);
 }
 
-pthread_mutex_t eval_lock = PTHREAD_MUTEX_INITIALIZER;
+// All JavaScript runs on the JS thread (js_thread.c); these hand it
+// Objective-C blocks.
+static void run_block(void *data) {
+    void (^block)(void) = (__bridge_transfer void (^)(void)) data;
+    block();
+}
 
-void acquire_eval_lock() {
-    pthread_mutex_lock(&eval_lock);
+void post_to_js_thread(enum js_task_kind kind, void (^block)(void)) {
+    js_thread_post(kind, run_block, (__bridge_retained void *) [block copy]);
 }
 
-void release_eval_lock() {
-    pthread_mutex_unlock(&eval_lock);
+void run_on_js_thread(enum js_task_kind kind, void (^block)(void)) {
+    js_thread_run(kind, run_block, (__bridge_retained void *) [block copy]);
 }
 
+static void run_microtask(void *data) {
+    JSObjectRef fn = data;
+    JSObjectCallAsFunction(ctx, fn, NULL, 0, NULL, NULL);
+    JSValueUnprotect(ctx, fn);
+}
+
+// queueMicrotask: fn runs once the current task is done, ahead of any
+// timer or evaluation queued behind it.
+JSValueRef function_queue_microtask(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueIsObject(ctx, args[0])) {
+        JSObjectRef fn = JSValueToObject(ctx, args[0], NULL);
+        if (JSObjectIsFunction(ctx, fn)) {
+            JSValueProtect(ctx, fn);
+            js_thread_queue_microtask(run_microtask, fn);
+        }
+    }
+    return JSValueMakeUndefined(ctx);
+}
+
+
+static void run_immediate(void *data) {
+    JSObjectRef fn = data;
+    watchdog_begin();
+    JSObjectCallAsFunction(ctx, fn, NULL, 0, NULL, NULL);
+    if (watchdog_end() != WATCHDOG_NONE) {
+        NSLog(@"Immediate callback terminated after running too long");
+    }
+    JSValueUnprotect(ctx, fn);
+}
+
+// setImmediate (and so goog.async.nextTick and core.async dispatch): fn
+// runs as a task of its own, behind whatever is already queued, so a
+// callback that keeps rescheduling itself takes turns with the rest.
+JSValueRef function_set_immediate(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueIsObject(ctx, args[0])) {
+        JSObjectRef fn = JSValueToObject(ctx, args[0], NULL);
+        if (JSObjectIsFunction(ctx, fn)) {
+            JSValueProtect(ctx, fn);
+            js_thread_post(JS_TASK_TIMER, run_immediate, fn);
+        }
+    }
+    return JSValueMakeUndefined(ctx);
+}
 
 char *munge(char *s) {
     size_t len = strlen(s);
@@ -271,171 +489,107 @@ JSObjectRef get_function(char *namespace, char *name) {
     return JSValueToObject(ctx, val, NULL);
 }
 
-typedef void (*timer_callback_t)(void *data);
-
-struct timer_data_t {
-    long millis;
-    timer_callback_t timer_callback;
-    void *data;
+struct timer_batch {
+    size_t count;
+    unsigned long ids[];
 };
 
-void *timer_thread(void *data) {
-    
-    struct timer_data_t *timer_data = data;
+static void run_timers(void *data) {
     
-    struct timespec t;
-    t.tv_sec = timer_data->millis / 1000;
-    t.tv_nsec = 1000 * 1000 * (timer_data->millis % 1000);
-    if (t.tv_sec == 0 && t.tv_nsec == 0) {
-        t.tv_nsec = 1; /* Evidently needed on Ubuntu 14.04 */
-    }
+    struct timer_batch *batch = data;
     
-    int err = nanosleep(&t, NULL);
-    if (err) {
-        free(data);
-        //engine_perror("timer nanosleep");
-        return NULL;
+    static JSObjectRef run_timers_fn = NULL;
+    if (!run_timers_fn) {
+        run_timers_fn = get_function("global", "REPLETE_RUN_TIMERS");
+        JSValueProtect(ctx, run_timers_fn);
     }
     
-    timer_data->timer_callback(timer_data->data);
-    
-    free(data);
-    
-    return NULL;
-}
-
-int start_timer(long millis, timer_callback_t timer_callback, void *data) {
-    
-    struct timer_data_t *timer_data = malloc(sizeof(struct timer_data_t));
-    if (!timer_data) return -1;
-    
-    timer_data->millis = millis;
-    timer_data->timer_callback = timer_callback;
-    timer_data->data = data;
-    
-    pthread_attr_t attr;
-    int err = pthread_attr_init(&attr);
-    if (err) {
-        free(timer_data);
-        return err;
+    JSValueRef *id_values = malloc(batch->count * sizeof(JSValueRef));
+    size_t i;
+    for (i = 0; i < batch->count; i++) {
+        id_values[i] = JSValueMakeNumber(ctx, (double)batch->ids[i]);
     }
-    
-    err = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    if (err) {
-        free(timer_data);
-        return err;
+    JSValueRef args[1];
+    args[0] = JSObjectMakeArray(ctx, batch->count, id_values, NULL);
+    free(id_values);
+    
+    // A runaway callback is stopped rather than holding up everything
+    // queued behind it; the rest of its batch is dropped with it.
+    watchdog_begin();
+    JSObjectCallAsFunction(ctx, run_timers_fn, NULL, 1, args, NULL);
+    if (watchdog_end() != WATCHDOG_NONE) {
+        NSLog(@"Timer callback terminated after running too long");
     }
     
-    pthread_t thread;
-    err = pthread_create(&thread, &attr, timer_thread, timer_data);
-    if (err) {
-        free(timer_data);
+    // Intervals in the batch are scheduled again only now that their
+    // callbacks have run.
+    for (i = 0; i < batch->count; i++) {
+        timer_rearm(batch->ids[i]);
     }
-    return err;
+    free(batch);
 }
 
-void do_run_timeout(void *data) {
-    
-    unsigned long *timeout_data = data;
-    
-    JSValueRef args[1];
-    args[0] = JSValueMakeNumber(ctx, (double)*timeout_data);
-    free(timeout_data);
-    
-    static JSObjectRef run_timeout_fn = NULL;
-    if (!run_timeout_fn) {
-        run_timeout_fn = get_function("global", "REPLETE_RUN_TIMEOUT");
-        JSValueProtect(ctx, run_timeout_fn);
-    }
-    acquire_eval_lock();
-    JSObjectCallAsFunction(ctx, run_timeout_fn, NULL, 1, args, NULL);
-    release_eval_lock();
+// Delivers every timeout and interval tick that came due together to
+// REPLETE_RUN_TIMERS as one JS thread task.
+void do_run_timers(const unsigned long *ids, size_t count, void *data) {
+    struct timer_batch *batch = malloc(sizeof(struct timer_batch) + count * sizeof(unsigned long));
+    batch->count = count;
+    memcpy(batch->ids, ids, count * sizeof(unsigned long));
+    js_thread_post(JS_TASK_TIMER, run_timers, batch);
 }
 
-static unsigned long timeout_id = 0;
-
 JSValueRef function_set_timeout(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                 size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1
         && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
         
-        int millis = (int) JSValueToNumber(ctx, args[0], NULL);
+        long millis = (long) JSValueToNumber(ctx, args[0], NULL);
         
-        if (timeout_id == 9007199254740991) {
-            timeout_id = 0;
-        } else {
-            ++timeout_id;
+        unsigned long id = timer_start(millis, 0, do_run_timers, NULL);
+        if (id) {
+            return JSValueMakeNumber(ctx, (double)id);
         }
-        
-        JSValueRef rv = JSValueMakeNumber(ctx, (double)timeout_id);
-        
-        unsigned long *timeout_data = malloc(sizeof(unsigned long));
-        *timeout_data = timeout_id;
-        
-        start_timer(millis, do_run_timeout, (void *) timeout_data);
-        
-        return rv;
     }
     return JSValueMakeNull(ctx);
 }
 
-void do_run_interval(void *data) {
-    
-    unsigned long *interval_data = data;
-    
-    JSValueRef args[1];
-    args[0] = JSValueMakeNumber(ctx, (double)*interval_data);
-    free(interval_data);
-    
-    static JSObjectRef run_interval_fn = NULL;
-    if (!run_interval_fn) {
-        run_interval_fn = get_function("global", "REPLETE_RUN_INTERVAL");
-        JSValueProtect(ctx, run_interval_fn);
-    }
-    acquire_eval_lock();
-    JSObjectCallAsFunction(ctx, run_interval_fn, NULL, 1, args, NULL);
-    release_eval_lock();
-}
-
-static unsigned long interval_id = 0;
-
+// The interval repeats natively, each tick scheduled once the previous
+// one has run, until REPLETE_CLEAR_TIMER.
 JSValueRef function_set_interval(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
-    if (argc == 2
+    if (argc == 1
         && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
         
-        int millis = (int) JSValueToNumber(ctx, args[0], NULL);
-        
-        unsigned long curr_interval_id;
-        
-        if (JSValueIsNull(ctx, args[1])) {
-            if (interval_id == 9007199254740991) {
-                interval_id = 0;
-            } else {
-                ++interval_id;
-            }
-            curr_interval_id = interval_id;
-        } else {
-            curr_interval_id = (unsigned long) JSValueToNumber(ctx, args[1], NULL);
+        long millis = (long) JSValueToNumber(ctx, args[0], NULL);
+        if (millis < 1) {
+            millis = 1;
         }
         
-        JSValueRef rv = JSValueMakeNumber(ctx, (double)curr_interval_id);
-        
-        unsigned long *interval_data = malloc(sizeof(unsigned long));
-        *interval_data = curr_interval_id;
-        
-        start_timer(millis, do_run_interval, (void *) interval_data);
-        
-        return rv;
+        unsigned long id = timer_start(millis, millis, do_run_timers, NULL);
+        if (id) {
+            return JSValueMakeNumber(ctx, (double)id);
+        }
     }
     return JSValueMakeNull(ctx);
 }
 
+JSValueRef function_clear_timer(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1
+        && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
+        timer_cancel((unsigned long) JSValueToNumber(ctx, args[0], NULL));
+    }
+    return JSValueMakeUndefined(ctx);
+}
+
 
 void bootstrap(JSContextRef ctx) {
     
+    TRACE_BEGIN("bootstrap", NULL);
+    
     char *deps_file_path = "main.js";
     char *goog_base_path = "goog/base.js";
+    char *startup_image_path = "replete/startup.js";
     
     char source[] = "<bootstrap>";
     
@@ -443,61 +597,100 @@ void bootstrap(JSContextRef ctx) {
     evaluate_script(ctx, "CLOSURE_IMPORT_SCRIPT = function(src) { AMBLY_IMPORT_SCRIPT('goog/' + src); return true; }",
                     source);
     
+    // A bundle made with BUNDLE_STARTUP_IMAGE=1 carries everything cljs.core
+    // loads as one script, evaluated once the environment below is set up;
+    // loadCompiler evaluates its companion image for replete.repl.
+    bool startup_image = bundle_contains(startup_image_path);
+    
+    // Otherwise inflate what the cljs.core and replete.repl requires will
+    // load on other cores while this thread evaluates. Launch with
+    // -DisableBundlePrefetch YES to compare startup without it.
+    if (!startup_image && ![[NSUserDefaults standardUserDefaults] boolForKey:@"DisableBundlePrefetch"]) {
+        const char *roots[] = {"cljs.core", "replete.repl"};
+        bundle_prefetch_start(roots, 2);
+    }
+    
+    // A bundle with a dependency index resolves goog.require natively, so
+    // neither goog/deps.js nor main.js needs to be evaluated.
+    bool native_deps = bundle_deps_count() > 0;
+    if (native_deps) {
+        evaluate_script(ctx, "var CLOSURE_NO_DEPS = true;", source);
+    }
+    
     // Load goog base
-    char *base_script_str = bundle_get_contents(goog_base_path);
-    if (base_script_str == NULL) {
+    if (!evaluate_bundled_script(ctx, goog_base_path, "<bootstrap:base>")) {
         fprintf(stderr, "The goog base JavaScript text could not be loaded\n");
         exit(1);
     }
-    evaluate_script(ctx, base_script_str, "<bootstrap:base>");
-    free(base_script_str);
     
-    // Load the deps file
-    char *deps_script_str = bundle_get_contents(deps_file_path);
-    if (deps_script_str == NULL) {
-        fprintf(stderr, "The deps JavaScript text could not be loaded\n");
-        exit(1);
+    if (native_deps) {
+        register_global_function(ctx, "REPLETE_REQUIRE", function_require);
+        evaluate_script(ctx,
+                        "goog.require__ = goog.require;\n"
+                        "goog.require = (src, reload) => {\n"
+                        "  let ret = REPLETE_REQUIRE(src, reload) ? null : goog.require__(src);\n"
+                        "  if (goog.isInModuleLoader_()) {\n"
+                        "    return goog.module.getInternal_(src);\n"
+                        "  } else {\n"
+                        "    return ret;\n"
+                        "  }\n"
+                        "};",
+                        source);
+    } else {
+        // Load the deps file
+        if (!evaluate_bundled_script(ctx, deps_file_path, "<bootstrap:deps>")) {
+            fprintf(stderr, "The deps JavaScript text could not be loaded\n");
+            exit(1);
+        }
+    }
+    
+    if (!startup_image) {
+        evaluate_script(ctx, "goog.require('cljs.core');", source);
     }
-    evaluate_script(ctx, deps_script_str, "<bootstrap:deps>");
-    free(deps_script_str);
-            
-    evaluate_script(ctx, "goog.require('cljs.core');", source);
     
     evaluate_script(ctx, "goog.isProvided_ = function(x) { return false; };", source);
     
     // redef goog.require to track loaded libs
-    evaluate_script(ctx,
-                    "goog.require__ = goog.require;\n"
-                    "goog.require = (src, reload) => {\n"
-                    "  if (reload === \"reload-all\") {\n"
-                    "    goog.cljsReloadAll_ = true;\n"
-                    "  }\n"
-                    "  if (reload || goog.cljsReloadAll_) {\n"
-                    "    if (goog.debugLoader_) {\n"
-                    "      let path = goog.debugLoader_.getPathFromDeps_(src);\n"
-                    "      goog.object.remove(goog.debugLoader_.written_, path);\n"
-                    "      goog.object.remove(goog.debugLoader_.written_, goog.basePath + path);\n"
-                    "    } else {\n"
-                    "      let path = goog.object.get(goog.dependencies_.nameToPath, src);\n"
-                    "      goog.object.remove(goog.dependencies_.visited, path);\n"
-                    "      goog.object.remove(goog.dependencies_.written, path);\n"
-                    "      goog.object.remove(goog.dependencies_.visited, goog.basePath + path);\n"
-                    "    }\n"
-                    "  }\n"
-                    "  let ret = goog.require__(src);\n"
-                    "  if (reload === \"reload-all\") {\n"
-                    "    goog.cljsReloadAll_ = false;\n"
-                    "  }\n"
-                    "  if (goog.isInModuleLoader_()) {\n"
-                    "    return goog.module.getInternal_(src);\n"
-                    "  } else {\n"
-                    "    return ret;\n"
-                    "  }\n"
-                    "};",
-                    source);
+    if (!native_deps) {
+        evaluate_script(ctx,
+                        "goog.require__ = goog.require;\n"
+                        "goog.require = (src, reload) => {\n"
+                        "  if (reload === \"reload-all\") {\n"
+                        "    goog.cljsReloadAll_ = true;\n"
+                        "  }\n"
+                        "  if (reload || goog.cljsReloadAll_) {\n"
+                        "    if (goog.debugLoader_) {\n"
+                        "      let path = goog.debugLoader_.getPathFromDeps_(src);\n"
+                        "      goog.object.remove(goog.debugLoader_.written_, path);\n"
+                        "      goog.object.remove(goog.debugLoader_.written_, goog.basePath + path);\n"
+                        "    } else {\n"
+                        "      let path = goog.object.get(goog.dependencies_.nameToPath, src);\n"
+                        "      goog.object.remove(goog.dependencies_.visited, path);\n"
+                        "      goog.object.remove(goog.dependencies_.written, path);\n"
+                        "      goog.object.remove(goog.dependencies_.visited, goog.basePath + path);\n"
+                        "    }\n"
+                        "  }\n"
+                        "  let ret = goog.require__(src);\n"
+                        "  if (reload === \"reload-all\") {\n"
+                        "    goog.cljsReloadAll_ = false;\n"
+                        "  }\n"
+                        "  if (goog.isInModuleLoader_()) {\n"
+                        "    return goog.module.getInternal_(src);\n"
+                        "  } else {\n"
+                        "    return ret;\n"
+                        "  }\n"
+                        "};",
+                        source);
+    }
     
     register_global_function(ctx, "REPLETE_SET_TIMEOUT", function_set_timeout);
     register_global_function(ctx, "REPLETE_SET_INTERVAL", function_set_interval);
+    register_global_function(ctx, "REPLETE_CLEAR_TIMER", function_clear_timer);
+    register_global_function(ctx, "REPLETE_TIMER_STATS", function_timer_stats);
+    register_global_function(ctx, "REPLETE_JS_THREAD_STATS", function_js_thread_stats);
+    register_global_function(ctx, "REPLETE_SET_TIME_LIMIT", function_set_time_limit);
+    register_global_function(ctx, "REPLETE_QUEUE_MICROTASK", function_queue_microtask);
+    register_global_function(ctx, "REPLETE_SET_IMMEDIATE", function_set_immediate);
     evaluate_script(ctx,
                     "var REPLETE_TIMEOUT_CALLBACK_STORE = {};\
                     var setTimeout = function( fn, ms ) {\
@@ -505,29 +698,39 @@ void bootstrap(JSContextRef ctx) {
                     REPLETE_TIMEOUT_CALLBACK_STORE[id] = fn;\
                     return id;\
                     };\
-                    var REPLETE_RUN_TIMEOUT = function( id ) {\
-                    if( REPLETE_TIMEOUT_CALLBACK_STORE[id] ) {\
-                    REPLETE_TIMEOUT_CALLBACK_STORE[id]();\
-                    delete REPLETE_TIMEOUT_CALLBACK_STORE[id];\
-                    }\
-                    };\
                     var clearTimeout = function( id ) {\
+                    REPLETE_CLEAR_TIMER(id);\
                     delete REPLETE_TIMEOUT_CALLBACK_STORE[id];\
                     };\
                     var REPLETE_INTERVAL_CALLBACK_STORE = {};\
                     var setInterval = function( fn, ms ) {\
-                    var id = REPLETE_SET_INTERVAL(ms, null);\
-                    REPLETE_INTERVAL_CALLBACK_STORE[id] = \
-                    function(){ fn(); REPLETE_SET_INTERVAL(ms, id); };\
+                    var id = REPLETE_SET_INTERVAL(ms);\
+                    REPLETE_INTERVAL_CALLBACK_STORE[id] = fn;\
                     return id;\
                     };\
-                    var REPLETE_RUN_INTERVAL = function( id ) {\
-                    if( REPLETE_INTERVAL_CALLBACK_STORE[id] ) {\
-                    REPLETE_INTERVAL_CALLBACK_STORE[id]();\
-                    }\
-                    };\
                     var clearInterval = function( id ) {\
+                    REPLETE_CLEAR_TIMER(id);\
                     delete REPLETE_INTERVAL_CALLBACK_STORE[id];\
+                    };\
+                    var REPLETE_RUN_TIMERS = function( ids ) {\
+                    for( var i = 0; i < ids.length; i++ ) {\
+                    var id = ids[i];\
+                    var fn = REPLETE_TIMEOUT_CALLBACK_STORE[id];\
+                    if( fn ) {\
+                    delete REPLETE_TIMEOUT_CALLBACK_STORE[id];\
+                    } else {\
+                    fn = REPLETE_INTERVAL_CALLBACK_STORE[id];\
+                    }\
+                    if( fn ) {\
+                    try { fn(); } catch( e ) {}\
+                    }\
+                    }\
+                    };\
+                    var queueMicrotask = function( fn ) {\
+                    REPLETE_QUEUE_MICROTASK(fn);\
+                    };\
+                    var setImmediate = function( fn ) {\
+                    REPLETE_SET_IMMEDIATE(fn);\
                     };",
                     "<init>");
     
@@ -569,15 +772,80 @@ void bootstrap(JSContextRef ctx) {
     register_global_function(ctx, "REPLETE_FSTAT", function_fstat);
     
     register_global_function(ctx, "REPLETE_REQUEST", function_http_request);
+    register_global_function(ctx, "REPLETE_REQUEST_ASYNC", function_http_request_async);
+    register_global_function(ctx, "REPLETE_REQUEST_CANCEL", function_http_request_cancel);
+    register_global_function(ctx, "REPLETE_HTTP_STATS", function_http_stats);
     
     register_global_function(ctx, "REPLETE_SLEEP", function_sleep);
     
+    register_global_function(ctx, "REPLETE_BUNDLE_CACHE_STATS", function_bundle_cache_stats);
+    register_global_function(ctx, "REPLETE_BUNDLE_LOAD_STATS", function_bundle_load_stats);
+    
+    register_global_function(ctx, "REPLETE_TRACE_START", function_trace_start);
+    register_global_function(ctx, "REPLETE_TRACE_STOP", function_trace_stop);
+    
+    if (startup_image) {
+        // The image calls this after each file, so the file's namespaces
+        // count as already loaded and are never imported again.
+        if (native_deps) {
+            register_global_function(ctx, "REPLETE_STARTUP_LOADED", function_startup_loaded);
+        } else {
+            evaluate_script(ctx,
+                            "var REPLETE_STARTUP_LOADED = (namespaces) => {\n"
+                            "  for (let ns of namespaces) {\n"
+                            "    if (goog.debugLoader_) {\n"
+                            "      let path = goog.debugLoader_.getPathFromDeps_(ns);\n"
+                            "      if (path) goog.debugLoader_.written_[path] = true;\n"
+                            "    } else {\n"
+                            "      let path = goog.dependencies_.nameToPath[ns];\n"
+                            "      if (path) goog.dependencies_.written[path] = true;\n"
+                            "    }\n"
+                            "  }\n"
+                            "};",
+                            source);
+        }
+        if (!evaluate_bundled_script(ctx, startup_image_path, "<bootstrap:startup>")) {
+            NSLog(@"Failed to get source for %s", startup_image_path);
+        }
+        // Loads whatever the image didn't get to, file by file.
+        evaluate_script(ctx, "goog.require('cljs.core');", source);
+    }
+    
+    TRACE_END("bootstrap");
 }
 
+// Startup is staged so the prompt comes up before the self-hosted compiler
+// is loaded. Stage one, waited for here, loads cljs.core and wires up
+// printing; stage two loads replete.repl (and with it the analyzer and
+// compiler) as the JS thread's next task, so evaluations posted meanwhile
+// run after it. Until it is done parinferFormat leaves the text alone.
 - (void)initializeJavaScriptEnvironment {
     
+    js_thread_start();
+    run_on_js_thread(JS_TASK_STARTUP, ^{
+        [self loadCore];
+    });
+    
+    NSLog(@"Time to first prompt: %.0f ms (cljs.core loaded)",
+          (CFAbsoluteTimeGetCurrent() - self.launchTime) * 1000);
+    
+    post_to_js_thread(JS_TASK_STARTUP, ^{
+        TRACE_BEGIN("loadCompiler", NULL);
+        [self loadCompiler];
+        TRACE_END("loadCompiler");
+        [self compilerLoadedAt:CFAbsoluteTimeGetCurrent()];
+    });
+}
+
+- (void)loadCore {
+    
+    TRACE_BEGIN("initializeJavaScriptEnvironment", NULL);
+    
     ctx = JSGlobalContextCreate(NULL);
     self.context = [JSContext contextWithJSGlobalContextRef:ctx];
+    if (!watchdog_install(ctx)) {
+        NSLog(@"Evaluations can't be time limited or interrupted");
+    }
 
     evaluate_script(ctx, "var global = this;", "<init>");
 
@@ -587,31 +855,15 @@ void bootstrap(JSContextRef ctx) {
     evaluate_script(ctx, "goog.provide('cljs.user');", "<init>");
     evaluate_script(ctx, "goog.require('cljs.core');", "<init>");
     
-    [self requireAppNamespaces:self.context];
-    
-    JSValue* setupCljsUser = [self getValue:@"setup-cljs-user" inNamespace:@"replete.repl" fromContext:self.context];
-    NSAssert(!setupCljsUser.isUndefined, @"Could not find the setup-cljs-user function");
-    [setupCljsUser callWithArguments:@[]];
-    
-#ifdef DEBUG
-    BOOL debugBuild = YES;
-#else
-    BOOL debugBuild = NO;
-#endif
-    
-#ifdef TARGET_IPHONE_SIMULATOR
-    BOOL targetSimulator = YES;
-#else
-    BOOL targetSimulator = NO;
-#endif
-    
     self.context[@"REPLETE_LOAD"] = ^(NSString *path) {
         
         //NSLog(@"Loading %@", path);
         char* contents = bundle_get_contents((char*)[path UTF8String]);
         
         if (contents) {
-            return [NSString stringWithUTF8String:contents];
+            NSString* result = [NSString stringWithUTF8String:contents];
+            bundle_release_contents(contents);
+            return result;
         } else {
             //NSLog(@"Failed to load %@", path);
         }
@@ -619,23 +871,6 @@ void bootstrap(JSContextRef ctx) {
         return (NSString*)nil;
     };
     
-    JSValue* initAppEnvFn = [self getValue:@"init-app-env" inNamespace:@"replete.repl" fromContext:self.context];
-    [initAppEnvFn callWithArguments:@[@{@"debug-build": @(debugBuild),
-                                        @"target-simulator": @(targetSimulator),
-                                        @"user-interface-idiom": (UI_USER_INTERFACE_IDIOM() == UIUserInterfaceIdiomPad ? @"iPad": @"iPhone")}]];
-    
-    self.readEvalPrintFn = [self getValue:@"read-eval-print" inNamespace:@"replete.repl" fromContext:self.context];
-    NSAssert(!self.readEvalPrintFn.isUndefined, @"Could not find the read-eval-print function");
-    
-    self.formatFn = [self getValue:@"format" inNamespace:@"replete.repl" fromContext:self.context];
-    NSAssert(!self.formatFn.isUndefined, @"Could not find the format function");
-    
-    self.setWidthFn = [self getValue:@"set-width" inNamespace:@"replete.repl" fromContext:self.context];
-    NSAssert(!self.setWidthFn.isUndefined, @"Could not find the set-width function");
-    
-    self.chivorcamReferred = [self getValue:@"chivorcam-referred" inNamespace:@"replete.repl" fromContext:self.context];
-    NSAssert(!self.chivorcamReferred.isUndefined, @"Could not find the chivorcam-referred function");
-    
     self.suppressPrinting = false;
     
     self.context[@"REPLETE_HIGH_RES_TIMER"] = ^() {
@@ -670,12 +905,92 @@ void bootstrap(JSContextRef ctx) {
     // TODO look into this. Without it thngs won't work.
     [self.context evaluateScript:@"var window = global;"];
     
-    self.initialized = true;
-    
     self.consentedToChivorcam = false;
     
+    TRACE_END("initializeJavaScriptEnvironment");
+}
+
+- (void)loadCompiler {
+    
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    
+    // Files the image doesn't cover are imported one by one by the
+    // require that follows.
+    char *compiler_image_path = "replete/compiler.js";
+    if (bundle_contains(compiler_image_path)) {
+        TRACE_BEGIN("compilerImage", NULL);
+        if (!evaluate_bundled_script(ctx, compiler_image_path, "<bootstrap:compiler>")) {
+            NSLog(@"Failed to get source for %s", compiler_image_path);
+        }
+        TRACE_END("compilerImage");
+    }
+    
+    TRACE_BEGIN("requireAppNamespaces", NULL);
+    [self requireAppNamespaces:self.context];
+    TRACE_END("requireAppNamespaces");
+    
+    JSValue* setupCljsUser = [self getValue:@"setup-cljs-user" inNamespace:@"replete.repl" fromContext:self.context];
+    NSAssert(!setupCljsUser.isUndefined, @"Could not find the setup-cljs-user function");
+    TRACE_BEGIN("setup-cljs-user", NULL);
+    [setupCljsUser callWithArguments:@[]];
+    TRACE_END("setup-cljs-user");
+    
+#ifdef DEBUG
+    BOOL debugBuild = YES;
+#else
+    BOOL debugBuild = NO;
+#endif
+    
+#ifdef TARGET_IPHONE_SIMULATOR
+    BOOL targetSimulator = YES;
+#else
+    BOOL targetSimulator = NO;
+#endif
+    
+    JSValue* initAppEnvFn = [self getValue:@"init-app-env" inNamespace:@"replete.repl" fromContext:self.context];
+    TRACE_BEGIN("init-app-env", NULL);
+    [initAppEnvFn callWithArguments:@[@{@"debug-build": @(debugBuild),
+                                        @"target-simulator": @(targetSimulator),
+                                        @"user-interface-idiom": (UI_USER_INTERFACE_IDIOM() == UIUserInterfaceIdiomPad ? @"iPad": @"iPhone")}]];
+    TRACE_END("init-app-env");
+    
+    self.readEvalPrintFn = [self getValue:@"read-eval-print" inNamespace:@"replete.repl" fromContext:self.context];
+    NSAssert(!self.readEvalPrintFn.isUndefined, @"Could not find the read-eval-print function");
+    
+    self.formatFn = [self getValue:@"format" inNamespace:@"replete.repl" fromContext:self.context];
+    NSAssert(!self.formatFn.isUndefined, @"Could not find the format function");
+    
+    self.setWidthFn = [self getValue:@"set-width" inNamespace:@"replete.repl" fromContext:self.context];
+    NSAssert(!self.setWidthFn.isUndefined, @"Could not find the set-width function");
+    
+    self.chivorcamReferred = [self getValue:@"chivorcam-referred" inNamespace:@"replete.repl" fromContext:self.context];
+    NSAssert(!self.chivorcamReferred.isUndefined, @"Could not find the chivorcam-referred function");
+    
     [self updateWidth];
+    
+    NSLog(@"Loaded replete.repl in %.0f ms", (CFAbsoluteTimeGetCurrent() - start) * 1000);
+}
 
+- (void)compilerLoadedAt:(CFAbsoluteTime)time {
+    
+    self.initialized = true;
+    self.compilerLoaded = true;
+    
+    bundle_prefetch_stop();
+    struct bundle_prefetch_stats prefetch_stats;
+    bundle_prefetch_get_stats(&prefetch_stats);
+    NSLog(@"Time to compiler: %.0f ms (prefetch: %d workers, %zu of %zu files, %zu bytes, %zu waits, %.1f ms waiting)",
+          (time - self.launchTime) * 1000, prefetch_stats.workers,
+          prefetch_stats.inflated, prefetch_stats.files, prefetch_stats.bytes,
+          prefetch_stats.waits, prefetch_stats.wait_ms);
+    
+    if (trace_enabled) {
+        const char *trace_path = sandbox("startup-trace.json");
+        if (trace_stop(trace_path)) {
+            NSLog(@"Wrote startup trace to %s", trace_path);
+        }
+    }
+    
     if ([self codeToBeEvaluatedWhenReady]) {
         NSLog(@"Delayed code to be evaluated: %@", [self codeToBeEvaluatedWhenReady]);
         [self evaluate:[self codeToBeEvaluatedWhenReady] asExpression:NO];
@@ -683,7 +998,6 @@ void bootstrap(JSContextRef ctx) {
             self.myPrintCallback(NO, @"(Loaded Code)");
         }
     }
-
 }
 
 -(void)requireAppNamespaces:(JSContext*)context
@@ -722,13 +1036,48 @@ void bootstrap(JSContextRef ctx) {
     [self evaluate:text asExpression:YES];
 }
 
-- (void)defmacroCalled:(NSString*)text
+// On the JS thread. Runs block under the evaluation time limit and says
+// so in the REPL if it was cut short.
+- (void)runLimited:(void (^)(void))block
 {
-    if (self.consentedToChivorcam) {
+    watchdog_begin();
+    block();
+    enum watchdog_reason reason = watchdog_end();
+    if (reason != WATCHDOG_NONE) {
+        self.suppressPrinting = false;
+        if (self.myPrintCallback) {
+            self.myPrintCallback(true, reason == WATCHDOG_INTERRUPTED
+                                 ? @"Evaluation interrupted"
+                                 : [NSString stringWithFormat:@"Evaluation timed out after %g seconds",
+                                    watchdog_get_limit()]);
+        }
+    }
+}
+
+// Safe from any thread.
+- (void)interruptEvaluation
+{
+    watchdog_interrupt();
+}
+
+// On the JS thread.
+- (void)evaluateDefmacro:(NSString*)text
+{
+    [self runLimited:^{
         self.suppressPrinting = true;
         [self.readEvalPrintFn callWithArguments:@[@"(require '[chivorcam.core :refer [defmacro defmacfn]])"]];
         self.suppressPrinting = false;
         [self.readEvalPrintFn callWithArguments:@[text, @true]];
+    }];
+}
+
+// On the main thread.
+- (void)defmacroCalled:(NSString*)text
+{
+    if (self.consentedToChivorcam) {
+        post_to_js_thread(JS_TASK_EVAL, ^{
+            [self evaluateDefmacro:text];
+        });
     } else {
         UIAlertController * alert = [UIAlertController
                                      alertControllerWithTitle:@"Enable REPL\nMacro Definitions?"
@@ -745,12 +1094,9 @@ void bootstrap(JSContextRef ctx) {
                                     actionWithTitle:@"OK"
                                     style:UIAlertActionStyleDefault
                                     handler:^(UIAlertAction * action) {
-                                        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(void){
-                                            self.consentedToChivorcam = true;
-                                            self.suppressPrinting = true;
-                                            [self.readEvalPrintFn callWithArguments:@[@"(require '[chivorcam.core :refer [defmacro defmacfn]])"]];
-                                            self.suppressPrinting = false;
-                                            [self.readEvalPrintFn callWithArguments:@[text, @true]];
+                                        self.consentedToChivorcam = true;
+                                        post_to_js_thread(JS_TASK_EVAL, ^{
+                                            [self evaluateDefmacro:text];
                                         });
                                     }];
         
@@ -785,21 +1131,37 @@ void bootstrap(JSContextRef ctx) {
     }
 }
 
+// Queued behind the compiler load, and anything evaluated before.
 -(void)evaluate:(NSString*)text asExpression:(BOOL)expression
 {
-    if (([text hasPrefix:@"(defmacro"] || [text hasPrefix:@"(defmacfn"])
-        && ![self.chivorcamReferred callWithArguments:@[]].toBool) {
-        [self defmacroCalled:text];
-    } else {
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(void){
-            [self.readEvalPrintFn callWithArguments:@[text, @(expression)]];
-        });
-    }
+    post_to_js_thread(JS_TASK_EVAL, ^{
+        if (([text hasPrefix:@"(defmacro"] || [text hasPrefix:@"(defmacfn"])
+            && ![self.chivorcamReferred callWithArguments:@[]].toBool) {
+            if (self.consentedToChivorcam) {
+                [self evaluateDefmacro:text];
+            } else {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    [self defmacroCalled:text];
+                });
+            }
+        } else {
+            [self runLimited:^{
+                [self.readEvalPrintFn callWithArguments:@[text, @(expression)]];
+            }];
+        }
+    });
 }
 
 -(NSArray*)parinferFormat:(NSString*)text pos:(int)pos enterPressed:(BOOL)enterPressed
 {
-    return [self.formatFn callWithArguments:@[text, @(pos), @(enterPressed)]].toArray;
+    if (!self.compilerLoaded) {
+        return @[text, @(pos)];
+    }
+    __block NSArray* result = nil;
+    run_on_js_thread(JS_TASK_UI, ^{
+        result = [self.formatFn callWithArguments:@[text, @(pos), @(enterPressed)]].toArray;
+    });
+    return result;
 }
 
 -(BOOL)application:(UIApplication *)application
@@ -854,7 +1216,9 @@ void bootstrap(JSContextRef ctx) {
         
         int width = ([[UIScreen mainScreen] applicationFrame].size.width - 10)/9;
         
-        [self.setWidthFn callWithArguments:@[@(width)]];
+        post_to_js_thread(JS_TASK_UI, ^{
+            [self.setWidthFn callWithArguments:@[@(width)]];
+        });
         
     }
 }
@@ -869,7 +1233,12 @@ void bootstrap(JSContextRef ctx) {
 -(NSString*)getClojureScriptVersion
 {
     // Grab bundle.js; it is relatively small
-    NSString* bundleJs = [NSString stringWithUTF8String:bundle_get_contents("replete/bundle.js")];
+    char* contents = bundle_get_contents("replete/bundle.js");
+    NSString* bundleJs = nil;
+    if (contents) {
+        bundleJs = [NSString stringWithUTF8String:contents];
+        bundle_release_contents(contents);
+    }
     
     if (bundleJs) {
         return [[bundleJs substringFromIndex:29] componentsSeparatedByString:@" "][0];
@@ -189,6 +189,16 @@ class ReplViewController: UIViewController, UITableViewDataSource, UITableViewDe
         //chat.draft = textView.text
     }
     
+    // Shake to stop a runaway evaluation.
+    override func motionEnded(_ motion: UIEventSubtype, with event: UIEvent?) {
+        if motion == .motionShake {
+            let appDelegate = UIApplication.shared.delegate as! AppDelegate
+            appDelegate.interruptEvaluation()
+        } else {
+            super.motionEnded(motion, with: event)
+        }
+    }
+    
     // This gets called a lot. Perhaps there's a better way to know when `view.window` has been set?
    override func viewDidLayoutSubviews()  {
         super.viewDidLayoutSubviews()
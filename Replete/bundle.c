@@ -1,15 +1,656 @@
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bundle.h"
+#include "bundle_cache.h"
+#include "bundle_format.h"
+#include "trace.h"
+
+// The bundle archive (see bundle_format.h) is mapped read-only and never
+// unmapped. Only the header, entry table and the blobs actually asked for
+// get paged in, so resident memory tracks what has been loaded rather
+// than the size of the bundle.
+
+static const unsigned char *archive = NULL;
+static size_t archive_len = 0;
+static const struct bundle_header *header = NULL;
+static const struct bundle_archive_entry *entries = NULL;
+static const char *paths = NULL;
+
+static const struct bundle_deps_header *deps_header = NULL;
+static const struct bundle_dep *deps = NULL;
+static const uint32_t *deps_requires = NULL;
+static const uint32_t *deps_slots = NULL;
+static const struct bundle_provide *deps_provides = NULL;
+static const char *deps_strings = NULL;
+
+static const void *bundle_dict = NULL;
+static size_t bundle_dict_len = 0;
 
 #include "bundle_inflate.h"
 
+static bool bundle_within(uint64_t offset, uint64_t len) {
+    return offset <= archive_len && len <= archive_len - offset;
+}
+
+static int bundle_validate_deps(void) {
+    if (!bundle_within(header->deps_offset, header->deps_len)
+        || header->deps_len < sizeof(struct bundle_deps_header)) {
+        return -1;
+    }
+    const struct bundle_deps_header *h = (const struct bundle_deps_header *) (archive + header->deps_offset);
+    uint64_t end = header->deps_offset + header->deps_len;
+    if (!bundle_within(h->deps_offset, (uint64_t) h->dep_count * sizeof(struct bundle_dep))
+        || !bundle_within(h->requires_offset, (uint64_t) h->require_count * sizeof(uint32_t))
+        || !bundle_within(h->slots_offset, (uint64_t) h->slot_count * sizeof(uint32_t))
+        || !bundle_within(h->provides_offset, (uint64_t) h->provide_count * sizeof(struct bundle_provide))
+        || h->strings_offset > end
+        || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0) {
+        return -1;
+    }
+    const struct bundle_dep *d = (const struct bundle_dep *) (archive + h->deps_offset);
+    const uint32_t *r = (const uint32_t *) (archive + h->requires_offset);
+    const struct bundle_provide *p = (const struct bundle_provide *) (archive + h->provides_offset);
+    uint64_t strings_len = end - h->strings_offset;
+    uint32_t i;
+    for (i = 0; i < h->dep_count; i++) {
+        if (d[i].path_offset >= strings_len
+            || (uint64_t) d[i].requires_index + d[i].requires_count > h->require_count) {
+            return -1;
+        }
+    }
+    for (i = 0; i < h->require_count; i++) {
+        if (r[i] >= h->dep_count) {
+            return -1;
+        }
+    }
+    for (i = 0; i < h->provide_count; i++) {
+        if (p[i].dep >= h->dep_count || p[i].name_offset >= strings_len) {
+            return -1;
+        }
+    }
+    const uint32_t *slots = (const uint32_t *) (archive + h->slots_offset);
+    for (i = 0; i < h->slot_count; i++) {
+        if (slots[i] > h->provide_count) {
+            return -1;
+        }
+    }
+    // Lookups stop at an empty slot, so there has to be one; and every
+    // string has to be terminated inside the index.
+    if (h->slot_count <= h->provide_count || (strings_len && archive[end - 1] != '\0')) {
+        return -1;
+    }
+
+    deps_header = h;
+    deps = (const struct bundle_dep *) (archive + h->deps_offset);
+    deps_requires = (const uint32_t *) (archive + h->requires_offset);
+    deps_slots = (const uint32_t *) (archive + h->slots_offset);
+    deps_provides = (const struct bundle_provide *) (archive + h->provides_offset);
+    deps_strings = (const char *) (archive + h->strings_offset);
+    return 0;
+}
+
+static int bundle_validate(void) {
+    if (archive_len < sizeof(struct bundle_header)) {
+        return -1;
+    }
+    header = (const struct bundle_header *) archive;
+    if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != BUNDLE_FORMAT_VERSION) {
+        return -1;
+    }
+    if (header->entries_offset + (uint64_t) header->entry_count * sizeof(struct bundle_archive_entry) > archive_len
+        || header->paths_offset > archive_len
+        || header->dict_offset + header->dict_len > archive_len) {
+        return -1;
+    }
+    entries = (const struct bundle_archive_entry *) (archive + header->entries_offset);
+    paths = (const char *) (archive + header->paths_offset);
+
+    uint32_t i;
+    for (i = 0; i < header->entry_count; i++) {
+        if (header->paths_offset + entries[i].path_offset + entries[i].path_len >= archive_len
+            || entries[i].data_offset + entries[i].compressed_len > archive_len) {
+            return -1;
+        }
+    }
+
+    if (header->dict_len) {
+        bundle_dict = archive + header->dict_offset;
+        bundle_dict_len = (size_t) header->dict_len;
+    }
+    if (header->deps_len) {
+        return bundle_validate_deps();
+    }
+    return 0;
+}
+
+int bundle_open(const char *path) {
+    if (path == NULL) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("bundle_open");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("bundle_open");
+        close(fd);
+        return -1;
+    }
+
+    void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        perror("bundle_open");
+        return -1;
+    }
+
+    // Loads jump around the archive, so don't read ahead of each fault.
+    madvise(addr, (size_t) st.st_size, MADV_RANDOM);
+
+    archive = addr;
+    archive_len = (size_t) st.st_size;
+    if (bundle_validate() != 0) {
+        fprintf(stderr, "bundle_open: %s is not a bundle archive\n", path);
+        munmap(addr, archive_len);
+        archive = NULL;
+        archive_len = 0;
+        header = NULL;
+        deps_header = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static const struct bundle_archive_entry *bundle_find(char *path) {
+    if (path == NULL || header == NULL) {
+        return NULL;
+    }
+
+    TRACE_BEGIN("lookup", path);
+    const struct bundle_archive_entry *found = NULL;
+    size_t lo = 0;
+    size_t hi = header->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(paths + entries[mid].path_offset, path);
+        if (cmp == 0) {
+            found = &entries[mid];
+            break;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    TRACE_END("lookup");
+
+    return found;
+}
+
+unsigned char *bundle_path_to_addr(char *path, unsigned int *len, unsigned int *gz_len) {
+    const struct bundle_archive_entry *entry = bundle_find(path);
+    if (entry == NULL) {
+        return NULL;
+    }
+    *gz_len = entry->compressed_len;
+    *len = entry->len;
+    return (unsigned char *) archive + entry->data_offset;
+}
+
+static int bundle_decompress(char *dest, unsigned char *src, unsigned int src_len, unsigned int len) {
+    switch (header->codec) {
+        case BUNDLE_CODEC_ID_NONE:
+            if (src_len != len) {
+                return -1;
+            }
+            memcpy(dest, src, len);
+            return 0;
+        case BUNDLE_CODEC_ID_GZIP:
+            return bundle_inflate(dest, src, src_len, len);
+#ifdef BUNDLE_CODEC_ZSTD
+        case BUNDLE_CODEC_ID_ZSTD:
+            return bundle_inflate_zstd(dest, src, src_len, len);
+#endif
+        default:
+            fprintf(stderr, "bundle: unsupported codec %u\n", header->codec);
+            return -1;
+    }
+}
+
+static int bundle_decompress_entry(char *dest, const struct bundle_archive_entry *entry) {
+    TRACE_BEGIN("inflate", paths + entry->path_offset);
+    int rv = bundle_decompress(dest, (unsigned char *) archive + entry->data_offset,
+                               entry->compressed_len, entry->len);
+    TRACE_END("inflate");
+    return rv;
+}
+
+bool bundle_contains(char *path) {
+    return bundle_find(path) != NULL;
+}
+
+// The entry's bytes as stored (UTF-8 or UTF-16LE), decompressed and cached.
+static char *bundle_get_entry(char *path, const struct bundle_archive_entry *entry) {
+    char *contents = bundle_cache_get(path);
+    if (contents != NULL) {
+        return contents;
+    }
+
+    contents = bundle_buffer_alloc(entry->len);
+    if (contents == NULL) {
+        return NULL;
+    }
+    if (bundle_decompress_entry(contents, entry) < 0) {
+        bundle_release_contents(contents);
+        return NULL;
+    }
+
+    return bundle_cache_put(path, contents);
+}
+
+static unsigned int utf16_unit(const unsigned char *src, size_t i) {
+    return src[2 * i] | (src[2 * i + 1] << 8);
+}
+
+// Transcodes units UTF-16LE code units to UTF-8. Pass dest NULL to measure.
+// Unpaired surrogates become U+FFFD.
+static size_t utf16_to_utf8(char *dest, const unsigned char *src, size_t units) {
+    size_t n = 0;
+    size_t i;
+    for (i = 0; i < units; i++) {
+        unsigned int c = utf16_unit(src, i);
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < units
+            && utf16_unit(src, i + 1) >= 0xDC00 && utf16_unit(src, i + 1) <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (utf16_unit(src, ++i) - 0xDC00);
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = 0xFFFD;
+        }
+
+        if (c < 0x80) {
+            if (dest) dest[n] = (char) c;
+            n += 1;
+        } else if (c < 0x800) {
+            if (dest) {
+                dest[n] = (char) (0xC0 | (c >> 6));
+                dest[n + 1] = (char) (0x80 | (c & 0x3F));
+            }
+            n += 2;
+        } else if (c < 0x10000) {
+            if (dest) {
+                dest[n] = (char) (0xE0 | (c >> 12));
+                dest[n + 1] = (char) (0x80 | ((c >> 6) & 0x3F));
+                dest[n + 2] = (char) (0x80 | (c & 0x3F));
+            }
+            n += 3;
+        } else {
+            if (dest) {
+                dest[n] = (char) (0xF0 | (c >> 18));
+                dest[n + 1] = (char) (0x80 | ((c >> 12) & 0x3F));
+                dest[n + 2] = (char) (0x80 | ((c >> 6) & 0x3F));
+                dest[n + 3] = (char) (0x80 | (c & 0x3F));
+            }
+            n += 4;
+        }
+    }
+    return n;
+}
+
 char *bundle_get_contents(char *path) {
-    fprintf(stderr, "WARN: no bundled sources, need to run script/bundle-c\n");
-    return NULL;
+    if (path == NULL) {
+        return NULL;
+    }
+
+    if (header == NULL) {
+        fprintf(stderr, "WARN: no bundled sources, need to run script/bundle\n");
+        return NULL;
+    }
+
+    const struct bundle_archive_entry *entry = bundle_find(path);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    if (!(entry->flags & BUNDLE_ENTRY_UTF16)) {
+        return bundle_get_entry(path, entry);
+    }
+
+    // Script evaluation goes through bundle_get_utf16; this is for the
+    // occasional caller that wants a UTF-16 entry as C string text.
+    const unsigned char *utf16;
+    char *stored = NULL;
+    if (header->codec == BUNDLE_CODEC_ID_NONE) {
+        utf16 = archive + entry->data_offset;
+    } else {
+        stored = bundle_get_entry(path, entry);
+        if (stored == NULL) {
+            return NULL;
+        }
+        utf16 = (const unsigned char *) stored;
+    }
+
+    size_t units = entry->len / 2;
+    char *contents = bundle_buffer_alloc(utf16_to_utf8(NULL, utf16, units));
+    if (contents != NULL) {
+        utf16_to_utf8(contents, utf16, units);
+    }
+    bundle_release_contents(stored);
+    return contents;
 }
 
-#ifdef BUNDLE_TEST
-int main(void) {
-    fprintf(stderr, "no bundled sources, need to run run script/bundle-c\n");
+// Scratch space for scripts the JS thread loads once, evaluates and never
+// asks for again. Inflating them into a heap buffer and the cache would
+// only churn the allocator and push out entries that do get reused, so
+// they go here instead: one buffer, grown geometrically to the largest
+// script seen and reused for every load after that. A startup image is
+// far bigger than any one script; the arena lets go of that much memory
+// again once the load is done.
+#define ARENA_RETAIN_LIMIT (4 * 1024 * 1024)
+
+static char *arena = NULL;
+static size_t arena_capacity = 0;
+static bool arena_in_use = false;
+
+static struct bundle_load_stats load_stats;
+
+static char *arena_reserve(size_t len) {
+    if (len + 1 > arena_capacity) {
+        size_t capacity = arena_capacity ? arena_capacity : 64 * 1024;
+        while (capacity < len + 1) {
+            capacity *= 2;
+        }
+        char *grown = realloc(arena, capacity);
+        if (grown == NULL) {
+            return NULL;
+        }
+        arena = grown;
+        arena_capacity = capacity;
+        load_stats.arena_grows++;
+        load_stats.arena_bytes = capacity;
+    }
+    arena[len] = '\0';
+    return arena;
+}
+
+char *bundle_load_script(char *path) {
+    load_stats.scripts++;
+
+    const struct bundle_archive_entry *entry = bundle_find(path);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    char *contents = bundle_cache_get(path);
+    if (contents != NULL) {
+        load_stats.cache_hits++;
+        return contents;
+    }
+
+    if (arena_in_use || (entry->flags & BUNDLE_ENTRY_UTF16)) {
+        load_stats.heap_loads++;
+        return bundle_get_contents(path);
+    }
+
+    contents = arena_reserve(entry->len);
+    if (contents == NULL
+        || bundle_decompress_entry(contents, entry) < 0) {
+        return NULL;
+    }
+    arena_in_use = true;
+    load_stats.arena_loads++;
+    return contents;
+}
+
+void bundle_done_script(char *script) {
+    if (script == NULL) {
+        return;
+    }
+    if (script == arena) {
+        arena_in_use = false;
+        if (arena_capacity > ARENA_RETAIN_LIMIT) {
+            free(arena);
+            arena = NULL;
+            arena_capacity = 0;
+            load_stats.arena_bytes = 0;
+        }
+    } else {
+        bundle_release_contents(script);
+    }
+}
+
+void bundle_get_load_stats(struct bundle_load_stats *stats) {
+    *stats = load_stats;
+}
+
+size_t bundle_deps_count(void) {
+    return deps_header ? deps_header->dep_count : 0;
+}
+
+int bundle_deps_find(const char *ns) {
+    if (deps_header == NULL) {
+        return -1;
+    }
+    uint32_t mask = deps_header->slot_count - 1;
+    uint32_t slot = bundle_hash_name(ns) & mask;
+    while (deps_slots[slot]) {
+        const struct bundle_provide *provide = &deps_provides[deps_slots[slot] - 1];
+        if (strcmp(deps_strings + provide->name_offset, ns) == 0) {
+            return (int) provide->dep;
+        }
+        slot = (slot + 1) & mask;
+    }
     return -1;
 }
+
+const char *bundle_deps_path(int dep) {
+    return deps_strings + deps[dep].path_offset;
+}
+
+bool bundle_deps_is_module(int dep) {
+    return (deps[dep].flags & BUNDLE_DEP_MODULE) != 0;
+}
+
+static void bundle_deps_visit(int dep, bool *visited, bool (*skip)(int dep), int *order, size_t *count) {
+    if (visited[dep] || (skip && skip(dep))) {
+        return;
+    }
+    visited[dep] = true;
+
+    uint32_t i;
+    for (i = 0; i < deps[dep].requires_count; i++) {
+        bundle_deps_visit((int) deps_requires[deps[dep].requires_index + i], visited, skip, order, count);
+    }
+    order[(*count)++] = dep;
+}
+
+int *bundle_deps_closure(const int *roots, size_t root_count, bool (*skip)(int dep), size_t *count) {
+    *count = 0;
+    if (deps_header == NULL) {
+        return NULL;
+    }
+
+    bool *visited = calloc(deps_header->dep_count, sizeof(bool));
+    int *order = malloc(deps_header->dep_count * sizeof(int));
+    if (visited == NULL || order == NULL) {
+        free(visited);
+        free(order);
+        return NULL;
+    }
+
+    size_t i;
+    for (i = 0; i < root_count; i++) {
+        if (roots[i] >= 0) {
+            bundle_deps_visit(roots[i], visited, skip, order, count);
+        }
+    }
+    free(visited);
+    return order;
+}
+
+size_t bundle_warm(char *path) {
+    const struct bundle_archive_entry *entry = bundle_find(path);
+    if (entry == NULL || header->codec == BUNDLE_CODEC_ID_NONE) {
+        return 0;
+    }
+
+    char *contents = bundle_get_entry(path, entry);
+    if (contents == NULL) {
+        return 0;
+    }
+    bundle_release_contents(contents);
+    return entry->len;
+}
+
+const unsigned short *bundle_get_utf16(char *path, size_t *length, bool *mapped) {
+    const struct bundle_archive_entry *entry = bundle_find(path);
+    if (entry == NULL || !(entry->flags & BUNDLE_ENTRY_UTF16)) {
+        return NULL;
+    }
+
+    *length = entry->len / 2;
+    *mapped = header->codec == BUNDLE_CODEC_ID_NONE;
+    if (*mapped) {
+        return (const unsigned short *) (archive + entry->data_offset);
+    }
+    return (const unsigned short *) bundle_get_entry(path, entry);
+}
+
+#ifdef BUNDLE_TEST
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        printf("%s <archive> <path>\n", argv[0]);
+        exit(1);
+    }
+
+    if (bundle_open(argv[1]) != 0) {
+        exit(1);
+    }
+
+    char *contents = bundle_get_contents(argv[2]);
+    if (contents == NULL) {
+        printf("not in bundle\n");
+        exit(1);
+    }
+
+    printf("%s", contents);
+    bundle_release_contents(contents);
+
+    return 0;
+}
+#endif
+
+#ifdef BUNDLE_BENCH
+#include <time.h>
+
+// Compare against every path in turn, as the generated lookup once did.
+static unsigned char *bundle_path_to_addr_linear(char *path, unsigned int *len, unsigned int *gz_len) {
+    uint32_t i;
+    for (i = 0; i < header->entry_count; i++) {
+        if (strcmp(paths + entries[i].path_offset, path) == 0) {
+            *gz_len = entries[i].compressed_len;
+            *len = entries[i].len;
+            return (unsigned char *) archive + entries[i].data_offset;
+        }
+    }
+    return NULL;
+}
+
+static double bench_now_nanos(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static double bench_lookup(unsigned char *(*lookup)(char *, unsigned int *, unsigned int *), int rounds) {
+    unsigned int len = 0;
+    unsigned int gz_len = 0;
+    size_t found = 0;
+    int r;
+    uint32_t i;
+    double start = bench_now_nanos();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < header->entry_count; i++) {
+            if (lookup((char *) paths + entries[i].path_offset, &len, &gz_len) != NULL) {
+                found++;
+            }
+        }
+    }
+    double elapsed = bench_now_nanos() - start;
+    if (found != (size_t) rounds * header->entry_count) {
+        fprintf(stderr, "lookup failed: found %zu of %zu\n", found, (size_t) rounds * header->entry_count);
+        exit(1);
+    }
+    return elapsed / ((double) rounds * header->entry_count);
+}
+
+// Decompresses every entry, bypassing the cache, and reports the total.
+static void bench_decompress(int rounds) {
+    size_t compressed = 0;
+    size_t uncompressed = 0;
+    uint32_t i;
+    for (i = 0; i < header->entry_count; i++) {
+        compressed += entries[i].compressed_len;
+        uncompressed += entries[i].len;
+    }
+
+    char *dest = malloc(uncompressed + 1);
+    double best = 0;
+    int r;
+    for (r = 0; r < rounds; r++) {
+        double start = bench_now_nanos();
+        for (i = 0; i < header->entry_count; i++) {
+            if (bundle_decompress(dest, (unsigned char *) archive + entries[i].data_offset,
+                                  entries[i].compressed_len, entries[i].len) < 0) {
+                fprintf(stderr, "failed to decompress %s\n", paths + entries[i].path_offset);
+                exit(1);
+            }
+        }
+        double elapsed = bench_now_nanos() - start;
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    free(dest);
+
+    printf("codec:         %s\n", header->codec == BUNDLE_CODEC_ID_ZSTD ? "zstd"
+                                   : header->codec == BUNDLE_CODEC_ID_NONE ? "none" : "gzip");
+    printf("archive:       %zu bytes\n", archive_len);
+    printf("uncompressed:  %zu bytes\n", uncompressed);
+    printf("compressed:    %zu bytes\n", compressed);
+    printf("dictionary:    %zu bytes\n", bundle_dict_len);
+    printf("decompress:    %8.2f ms for all entries (best of %d)\n", best / 1e6, rounds);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("%s <archive> [rounds]\n", argv[0]);
+        exit(1);
+    }
+
+    if (bundle_open(argv[1]) != 0) {
+        exit(1);
+    }
+
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+
+    printf("%u bundled paths, %d rounds\n", header->entry_count, rounds);
+    printf("binary search: %8.1f ns/lookup\n", bench_lookup(bundle_path_to_addr, rounds));
+    printf("linear scan:   %8.1f ns/lookup\n", bench_lookup(bundle_path_to_addr_linear, rounds));
+
+    bench_decompress(rounds < 10 ? rounds : 10);
+
+    return 0;
+}
 #endif
@@ -1 +1,54 @@
-char *bundle_get_contents(char *path);
\ No newline at end of file
+#include <stdbool.h>
+#include <stddef.h>
+
+int bundle_open(const char *path);
+
+bool bundle_contains(char *path);
+
+char *bundle_get_contents(char *path);
+
+void bundle_release_contents(char *contents);
+
+// Inflates path into the cache ahead of use. Returns the bytes inflated,
+// 0 if there was nothing to do.
+size_t bundle_warm(char *path);
+
+struct bundle_load_stats {
+    unsigned long scripts;
+    unsigned long cache_hits;
+    unsigned long arena_loads;
+    unsigned long heap_loads;
+    unsigned long arena_grows;
+    size_t arena_bytes;
+};
+
+// For the JS thread's one-shot script loads. Returns path's text, inflated
+// into a scratch arena unless it is already cached. The text is only valid
+// until bundle_done_script; loads made before then fall back to the heap.
+char *bundle_load_script(char *path);
+
+void bundle_done_script(char *script);
+
+void bundle_get_load_stats(struct bundle_load_stats *stats);
+
+// The dependency index script/bundle writes into the archive: dependency
+// numbers for namespaces, and their paths and load order. Without one,
+// bundle_deps_count is 0 and bundle_deps_find always -1.
+size_t bundle_deps_count(void);
+
+int bundle_deps_find(const char *ns);
+
+const char *bundle_deps_path(int dep);
+
+bool bundle_deps_is_module(int dep);
+
+// The roots and everything they require, each after what it requires,
+// leaving out any dep for which skip returns true along with whatever only
+// it leads to. The caller frees the result.
+int *bundle_deps_closure(const int *roots, size_t root_count, bool (*skip)(int dep), size_t *count);
+
+// For a script bundled as UTF-16 (BUNDLE_ENCODING=utf16), its code units;
+// NULL otherwise. If mapped, they are in the archive itself and stay valid
+// for the life of the app. If not, they are an inflated copy held in the
+// cache, to be released with bundle_release_contents.
+const unsigned short *bundle_get_utf16(char *path, size_t *length, bool *mapped);
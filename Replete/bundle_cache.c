@@ -0,0 +1,258 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bundle.h"
+#include "bundle_cache.h"
+
+// Inflated bundle sources, kept in an LRU list bounded by a byte budget.
+//
+// Buffers handed out by bundle_get_contents are reference counted: the
+// cache holds one reference while an entry is resident and each caller
+// holds another until it calls bundle_release_contents. Evicting an entry
+// only drops the cache's reference, so a caller never sees its buffer
+// freed underneath it.
+
+#define BUNDLE_CACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+#define BUNDLE_CACHE_INITIAL_BUCKETS 256
+
+struct bundle_buffer {
+    int refcount;
+    size_t len;
+    char *path;
+    struct bundle_buffer *lru_prev;
+    struct bundle_buffer *lru_next;
+    struct bundle_buffer *bucket_next;
+    char data[];
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct bundle_buffer **buckets = NULL;
+static size_t bucket_count = 0;
+
+// Most recently used at the head, eviction candidates at the tail.
+static struct bundle_buffer *lru_head = NULL;
+static struct bundle_buffer *lru_tail = NULL;
+
+static size_t budget = BUNDLE_CACHE_DEFAULT_BUDGET;
+static struct bundle_cache_stats stats;
+
+static struct bundle_buffer *buffer_for_contents(char *contents) {
+    return (struct bundle_buffer *) (contents - offsetof(struct bundle_buffer, data));
+}
+
+static unsigned long hash_path(const char *path) {
+    unsigned long h = 2166136261UL;
+    while (*path) {
+        h ^= (unsigned char) *path++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static void buffer_free(struct bundle_buffer *buffer) {
+    free(buffer->path);
+    free(buffer);
+}
+
+static void lru_unlink(struct bundle_buffer *buffer) {
+    if (buffer->lru_prev) {
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    } else {
+        lru_head = buffer->lru_next;
+    }
+    if (buffer->lru_next) {
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    } else {
+        lru_tail = buffer->lru_prev;
+    }
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+static void lru_push_front(struct bundle_buffer *buffer) {
+    buffer->lru_prev = NULL;
+    buffer->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = buffer;
+    }
+    lru_head = buffer;
+    if (!lru_tail) {
+        lru_tail = buffer;
+    }
+}
+
+static struct bundle_buffer *find(const char *path, unsigned long h) {
+    if (!buckets) {
+        return NULL;
+    }
+    struct bundle_buffer *buffer = buckets[h & (bucket_count - 1)];
+    while (buffer && strcmp(buffer->path, path) != 0) {
+        buffer = buffer->bucket_next;
+    }
+    return buffer;
+}
+
+static void bucket_remove(struct bundle_buffer *buffer) {
+    struct bundle_buffer **link = &buckets[hash_path(buffer->path) & (bucket_count - 1)];
+    while (*link != buffer) {
+        link = &(*link)->bucket_next;
+    }
+    *link = buffer->bucket_next;
+    buffer->bucket_next = NULL;
+}
+
+static bool grow_buckets(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : BUNDLE_CACHE_INITIAL_BUCKETS;
+    struct bundle_buffer **new_buckets = calloc(new_count, sizeof(struct bundle_buffer *));
+    if (!new_buckets) {
+        return false;
+    }
+    size_t i;
+    for (i = 0; i < bucket_count; i++) {
+        struct bundle_buffer *buffer = buckets[i];
+        while (buffer) {
+            struct bundle_buffer *next = buffer->bucket_next;
+            size_t slot = hash_path(buffer->path) & (new_count - 1);
+            buffer->bucket_next = new_buckets[slot];
+            new_buckets[slot] = buffer;
+            buffer = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return true;
+}
+
+// Drops the cache's reference to buffer. Called with cache_lock held.
+static void evict(struct bundle_buffer *buffer) {
+    bucket_remove(buffer);
+    lru_unlink(buffer);
+    stats.entries--;
+    stats.bytes -= buffer->len;
+    stats.evictions++;
+    if (--buffer->refcount == 0) {
+        buffer_free(buffer);
+    }
+}
+
+static void evict_to_budget(size_t incoming) {
+    while (lru_tail && stats.bytes + incoming > budget) {
+        evict(lru_tail);
+    }
+}
+
+char *bundle_buffer_alloc(size_t len) {
+    struct bundle_buffer *buffer = malloc(sizeof(struct bundle_buffer) + len + 1);
+    if (!buffer) {
+        return NULL;
+    }
+    buffer->refcount = 1;
+    buffer->len = len;
+    buffer->path = NULL;
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+    buffer->bucket_next = NULL;
+    buffer->data[len] = '\0';
+
+    pthread_mutex_lock(&cache_lock);
+    stats.allocations++;
+    stats.allocated_bytes += len;
+    pthread_mutex_unlock(&cache_lock);
+
+    return buffer->data;
+}
+
+void bundle_release_contents(char *contents) {
+    if (contents == NULL) {
+        return;
+    }
+    struct bundle_buffer *buffer = buffer_for_contents(contents);
+    pthread_mutex_lock(&cache_lock);
+    bool last = --buffer->refcount == 0;
+    pthread_mutex_unlock(&cache_lock);
+    if (last) {
+        buffer_free(buffer);
+    }
+}
+
+char *bundle_cache_get(const char *path) {
+    pthread_mutex_lock(&cache_lock);
+    struct bundle_buffer *buffer = find(path, hash_path(path));
+    if (buffer) {
+        buffer->refcount++;
+        lru_unlink(buffer);
+        lru_push_front(buffer);
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return buffer ? buffer->data : NULL;
+}
+
+char *bundle_cache_put(const char *path, char *contents) {
+    struct bundle_buffer *buffer = buffer_for_contents(contents);
+    if (buffer->len > budget) {
+        return contents;
+    }
+
+    char *path_copy = strdup(path);
+    if (!path_copy) {
+        return contents;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    // Another thread may have inflated the same path while we did; keep
+    // the resident copy and hand that one out instead.
+    unsigned long h = hash_path(path);
+    struct bundle_buffer *existing = find(path, h);
+    if (existing) {
+        existing->refcount++;
+        lru_unlink(existing);
+        lru_push_front(existing);
+        pthread_mutex_unlock(&cache_lock);
+        free(path_copy);
+        bundle_release_contents(contents);
+        return existing->data;
+    }
+
+    if ((stats.entries + 1) * 4 > bucket_count * 3 && !grow_buckets()) {
+        pthread_mutex_unlock(&cache_lock);
+        free(path_copy);
+        return contents;
+    }
+
+    evict_to_budget(buffer->len);
+
+    buffer->path = path_copy;
+    buffer->refcount++;
+    size_t slot = h & (bucket_count - 1);
+    buffer->bucket_next = buckets[slot];
+    buckets[slot] = buffer;
+    lru_push_front(buffer);
+    stats.entries++;
+    stats.bytes += buffer->len;
+
+    pthread_mutex_unlock(&cache_lock);
+    return contents;
+}
+
+void bundle_cache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&cache_lock);
+    budget = bytes;
+    evict_to_budget(0);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void bundle_cache_get_stats(struct bundle_cache_stats *out) {
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    out->budget = budget;
+    pthread_mutex_unlock(&cache_lock);
+}
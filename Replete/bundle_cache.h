@@ -0,0 +1,22 @@
+#include <stddef.h>
+
+struct bundle_cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+    unsigned long allocations;
+    size_t allocated_bytes;
+};
+
+char *bundle_buffer_alloc(size_t len);
+
+char *bundle_cache_get(const char *path);
+
+char *bundle_cache_put(const char *path, char *contents);
+
+void bundle_cache_set_budget(size_t bytes);
+
+void bundle_cache_get_stats(struct bundle_cache_stats *stats);
@@ -0,0 +1,104 @@
+#include <stdint.h>
+
+// Layout of the bundle archive written by script/bundle (via
+// script/bundle_pack.c) and mapped by bundle.c at runtime:
+//
+//   struct bundle_header
+//   struct bundle_archive_entry[entry_count], sorted by path (strcmp order)
+//   NUL-terminated paths, referenced by path_offset
+//   dictionary (zstd only), at dict_offset
+//   dependency index (if any), at deps_offset
+//   compressed blobs, each starting on a BUNDLE_ALIGN boundary
+//
+// An entry flagged BUNDLE_ENTRY_UTF16 holds UTF-16LE text rather than
+// UTF-8 (script/bundle with BUNDLE_ENCODING=utf16), and len counts bytes.
+// Stored (BUNDLE_CODEC_ID_NONE) blobs are the text itself, so the UTF-16
+// ones can be handed to JavaScriptCore straight out of the mapping.
+//
+// The dependency index is the goog.addDependency graph from main.js and
+// goog/deps.js, resolved at bundle time so neither file has to be
+// evaluated at launch:
+//
+//   struct bundle_deps_header
+//   struct bundle_dep[dep_count]
+//   uint32_t requires[require_count], dep indexes; each dep's run starts
+//       at its requires_index
+//   uint32_t slots[slot_count], an open addressing table (linear probing
+//       on bundle_hash_name) of provide index + 1, 0 for an empty slot
+//   struct bundle_provide[provide_count]
+//   NUL-terminated strings, referenced by path_offset and name_offset
+//
+// Offsets are from the start of the file, except path_offset, which is
+// from paths_offset (strings_offset in the dependency index), and
+// name_offset, which is from strings_offset. Integers are stored in host
+// (little-endian) byte order; the archive is built on the same kind of
+// machine it is read on.
+
+#define BUNDLE_MAGIC "RPLBNDL\0"
+#define BUNDLE_FORMAT_VERSION 3
+#define BUNDLE_ALIGN 16
+
+#define BUNDLE_CODEC_ID_GZIP 1
+#define BUNDLE_CODEC_ID_ZSTD 2
+#define BUNDLE_CODEC_ID_NONE 3
+
+#define BUNDLE_ENTRY_UTF16 0x1
+
+#define BUNDLE_DEP_MODULE 0x1
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t codec;
+    uint32_t entry_count;
+    uint32_t flags;
+    uint64_t entries_offset;
+    uint64_t paths_offset;
+    uint64_t dict_offset;
+    uint64_t dict_len;
+    uint64_t deps_offset;
+    uint64_t deps_len;
+};
+
+struct bundle_archive_entry {
+    uint32_t path_offset;
+    uint32_t path_len;
+    uint64_t data_offset;
+    uint32_t compressed_len;
+    uint32_t len;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct bundle_deps_header {
+    uint32_t dep_count;
+    uint32_t require_count;
+    uint32_t slot_count;
+    uint32_t provide_count;
+    uint64_t deps_offset;
+    uint64_t requires_offset;
+    uint64_t slots_offset;
+    uint64_t provides_offset;
+    uint64_t strings_offset;
+};
+
+struct bundle_dep {
+    uint32_t path_offset;
+    uint32_t requires_index;
+    uint32_t requires_count;
+    uint32_t flags;
+};
+
+struct bundle_provide {
+    uint32_t name_offset;
+    uint32_t dep;
+};
+
+static inline uint32_t bundle_hash_name(const char *name) {
+    uint32_t h = 2166136261U;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619U;
+    }
+    return h;
+}
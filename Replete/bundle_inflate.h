@@ -41,3 +41,52 @@ int bundle_inflate(char *dest, unsigned char *src, unsigned int src_len, unsigne
 
     return done ? 0 : -1;
 }
+
+#ifdef BUNDLE_CODEC_ZSTD
+#include <pthread.h>
+
+#include <zstd.h>
+
+// Every entry is compressed against the same dictionary (bundle_dict, emitted
+// by script/bundle), so it is digested once and shared. Decompression
+// contexts are kept per thread and reused across calls.
+static ZSTD_DDict *bundle_ddict = NULL;
+static pthread_key_t bundle_dctx_key;
+static pthread_once_t bundle_zstd_once = PTHREAD_ONCE_INIT;
+
+static void bundle_free_dctx(void *dctx) {
+    ZSTD_freeDCtx((ZSTD_DCtx *) dctx);
+}
+
+static void bundle_zstd_init(void) {
+    bundle_ddict = ZSTD_createDDict(bundle_dict, bundle_dict_len);
+    pthread_key_create(&bundle_dctx_key, bundle_free_dctx);
+}
+
+int bundle_inflate_zstd(char *dest, unsigned char *src, unsigned int src_len, unsigned int len) {
+    if (src_len == 0) {
+        return 0;
+    }
+
+    pthread_once(&bundle_zstd_once, bundle_zstd_init);
+    if (bundle_ddict == NULL) {
+        return -1;
+    }
+
+    ZSTD_DCtx *dctx = pthread_getspecific(bundle_dctx_key);
+    if (dctx == NULL) {
+        dctx = ZSTD_createDCtx();
+        if (dctx == NULL) {
+            return -1;
+        }
+        pthread_setspecific(bundle_dctx_key, dctx);
+    }
+
+    size_t res = ZSTD_decompress_usingDDict(dctx, dest, len, src, src_len, bundle_ddict);
+    if (ZSTD_isError(res) || res != len) {
+        return -1;
+    }
+
+    return 0;
+}
+#endif
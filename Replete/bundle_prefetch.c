@@ -0,0 +1,290 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bundle.h"
+#include "bundle_cache.h"
+#include "bundle_prefetch.h"
+#include "goog_deps.h"
+
+// Inflates the files that requiring the given namespaces will load, on a
+// few worker threads, ahead of the JS thread that evaluates them.
+//
+// The dependency graph comes from the bundle's dependency index, or the
+// goog.addDependency calls in main.js and goog/deps.js for a bundle
+// without one. Jobs are queued in load order (dependencies first), so the
+// workers inflate what the JS thread is about to ask for next.
+// Once the inflated but not yet claimed bytes reach half the cache budget
+// they wait for the JS thread to catch up, so nothing they inflated gets
+// evicted before it is used.
+
+#define PREFETCH_MAX_WORKERS 4
+
+enum job_state {
+    JOB_PENDING,
+    JOB_INFLATING,
+    JOB_DONE,
+    JOB_CLAIMED
+};
+
+struct job {
+    char *path;
+    size_t len;
+    enum job_state state;
+};
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+static struct job *jobs = NULL;
+static size_t job_count = 0;
+static size_t next_job = 0;
+
+// Indexes into jobs, sorted by path, for bundle_prefetch_claim.
+static size_t *jobs_by_path = NULL;
+
+static bool running = false;
+static bool stopping = false;
+static int active_workers = 0;
+static size_t ahead_bytes = 0;
+static size_t window_bytes = 0;
+
+static struct bundle_prefetch_stats stats;
+
+static double now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int compare_job_paths(const void *a, const void *b) {
+    return strcmp(jobs[*(const size_t *) a].path, jobs[*(const size_t *) b].path);
+}
+
+static struct job *find_job(const char *path) {
+    size_t lo = 0;
+    size_t hi = job_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(jobs[jobs_by_path[mid]].path, path);
+        if (cmp == 0) {
+            return &jobs[jobs_by_path[mid]];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static bool parse_bundled_deps(char *path, struct goog_deps *deps) {
+    char *text = bundle_get_contents(path);
+    if (text == NULL) {
+        return false;
+    }
+    goog_deps_parse(deps, text);
+    bundle_release_contents(text);
+    return true;
+}
+
+static void *worker(void *arg) {
+    pthread_mutex_lock(&prefetch_lock);
+    for (;;) {
+        while (!stopping && next_job < job_count && ahead_bytes >= window_bytes) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        }
+        while (next_job < job_count && jobs[next_job].state != JOB_PENDING) {
+            next_job++;
+        }
+        if (stopping || next_job == job_count) {
+            break;
+        }
+
+        struct job *job = &jobs[next_job++];
+        job->state = JOB_INFLATING;
+        pthread_mutex_unlock(&prefetch_lock);
+
+        size_t len = bundle_warm(job->path);
+
+        pthread_mutex_lock(&prefetch_lock);
+        job->len = len;
+        job->state = JOB_DONE;
+        ahead_bytes += len;
+        if (len) {
+            stats.inflated++;
+            stats.bytes += len;
+        }
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    active_workers--;
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+    return NULL;
+}
+
+// The paths requiring roots loads, in load order, from the bundle's
+// dependency index or, for a bundle without one, from main.js and
+// goog/deps.js. The caller frees the paths and the array.
+static char **load_order(const char **roots, size_t root_count, size_t *count) {
+    char **paths = NULL;
+    size_t i;
+    *count = 0;
+
+    if (bundle_deps_count() > 0) {
+        int *root_deps = malloc((root_count ? root_count : 1) * sizeof(int));
+        for (i = 0; i < root_count; i++) {
+            root_deps[i] = bundle_deps_find(roots[i]);
+        }
+        int *order = bundle_deps_closure(root_deps, root_count, NULL, count);
+        free(root_deps);
+        if (order == NULL) {
+            return NULL;
+        }
+        paths = malloc((*count ? *count : 1) * sizeof(char *));
+        for (i = 0; i < *count; i++) {
+            paths[i] = strdup(bundle_deps_path(order[i]));
+        }
+        free(order);
+        return paths;
+    }
+
+    struct goog_deps deps;
+    memset(&deps, 0, sizeof(deps));
+    if (parse_bundled_deps("goog/deps.js", &deps) && parse_bundled_deps("main.js", &deps)) {
+        size_t *order = goog_deps_closure(&deps, roots, root_count, count);
+        if (order != NULL) {
+            paths = malloc((*count ? *count : 1) * sizeof(char *));
+            for (i = 0; i < *count; i++) {
+                paths[i] = strdup(deps.deps[order[i]].path);
+            }
+            free(order);
+        }
+    }
+    goog_deps_free(&deps);
+    return paths;
+}
+
+void bundle_prefetch_start(const char **roots, size_t root_count) {
+    size_t count = 0;
+    char **paths = load_order(roots, root_count, &count);
+    if (paths == NULL) {
+        return;
+    }
+
+    size_t i;
+    pthread_mutex_lock(&prefetch_lock);
+    if (running) {
+        pthread_mutex_unlock(&prefetch_lock);
+        for (i = 0; i < count; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        return;
+    }
+
+    jobs = calloc(count ? count : 1, sizeof(struct job));
+    jobs_by_path = malloc((count ? count : 1) * sizeof(size_t));
+    for (i = 0; i < count; i++) {
+        jobs[i].path = paths[i];
+        jobs[i].state = JOB_PENDING;
+        jobs_by_path[i] = i;
+    }
+    job_count = count;
+    qsort(jobs_by_path, job_count, sizeof(size_t), compare_job_paths);
+    free(paths);
+
+    struct bundle_cache_stats cache_stats;
+    bundle_cache_get_stats(&cache_stats);
+    window_bytes = cache_stats.budget / 2;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 1 ? (int) cpus - 1 : 1;
+    if (workers > PREFETCH_MAX_WORKERS) {
+        workers = PREFETCH_MAX_WORKERS;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.files = job_count;
+    running = true;
+    stopping = false;
+    next_job = 0;
+    ahead_bytes = 0;
+
+    for (i = 0; i < (size_t) workers; i++) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, worker, NULL) == 0) {
+            active_workers++;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    stats.workers = active_workers;
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+// Called on the JS thread before it loads path. If a worker is inflating
+// path right now, waits for it rather than inflating it a second time;
+// if no worker has got to it yet, takes it so none will.
+void bundle_prefetch_claim(char *path) {
+    pthread_mutex_lock(&prefetch_lock);
+    struct job *job = running ? find_job(path) : NULL;
+    if (job == NULL) {
+        pthread_mutex_unlock(&prefetch_lock);
+        return;
+    }
+
+    if (job->state == JOB_INFLATING) {
+        double start = now_ms();
+        while (job->state == JOB_INFLATING) {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        }
+        stats.waits++;
+        stats.wait_ms += now_ms() - start;
+    }
+    if (job->state == JOB_DONE) {
+        ahead_bytes -= job->len;
+        pthread_cond_broadcast(&prefetch_cond);
+    }
+    job->state = JOB_CLAIMED;
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+// Stops the workers once they finish what they are inflating and frees the
+// job list. Whatever they inflated stays in the cache.
+void bundle_prefetch_stop(void) {
+    pthread_mutex_lock(&prefetch_lock);
+    if (!running) {
+        pthread_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    stopping = true;
+    pthread_cond_broadcast(&prefetch_cond);
+    while (active_workers > 0) {
+        pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+    }
+
+    size_t i;
+    for (i = 0; i < job_count; i++) {
+        free(jobs[i].path);
+    }
+    free(jobs);
+    free(jobs_by_path);
+    jobs = NULL;
+    jobs_by_path = NULL;
+    job_count = 0;
+    next_job = 0;
+    running = false;
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+void bundle_prefetch_get_stats(struct bundle_prefetch_stats *out) {
+    pthread_mutex_lock(&prefetch_lock);
+    *out = stats;
+    pthread_mutex_unlock(&prefetch_lock);
+}
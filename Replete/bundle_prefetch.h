@@ -0,0 +1,18 @@
+#include <stddef.h>
+
+struct bundle_prefetch_stats {
+    int workers;
+    size_t files;
+    size_t inflated;
+    size_t bytes;
+    size_t waits;
+    double wait_ms;
+};
+
+void bundle_prefetch_start(const char **roots, size_t root_count);
+
+void bundle_prefetch_claim(char *path);
+
+void bundle_prefetch_stop(void);
+
+void bundle_prefetch_get_stats(struct bundle_prefetch_stats *stats);
@@ -16,9 +16,15 @@
 #include <JavaScriptCore/JavaScript.h>
 
 #include "bundle.h"
+#include "bundle_cache.h"
 #include "io.h"
 #include "jsc_utils.h"
 #include "file.h"
+#include "trace.h"
+#include "path_set.h"
+#include "timer.h"
+#include "watchdog.h"
+#include "js_thread.h"
 
 #define CONSOLE_LOG_BUF_SIZE 1000
 char console_log_buf[CONSOLE_LOG_BUF_SIZE];
@@ -163,33 +169,14 @@ JSValueRef function_raw_flush_stderr(JSContextRef ctx, JSObjectRef function, JSO
 
 
 #ifdef DEFHASHFNS
-unsigned long hash(unsigned char *str) {
-    unsigned long hash = 5381;
-    int c;
-    
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    
-    return hash;
-}
+static struct path_set loaded_goog_paths;
 
-static unsigned long loaded_goog_hashes[2048];
-static size_t count_loaded_goog_hashes = 0;
-
-bool is_loaded(unsigned long h) {
-    size_t i;
-    for (i = 0; i < count_loaded_goog_hashes; ++i) {
-        if (loaded_goog_hashes[i] == h) {
-            return true;
-        }
-    }
-    return false;
+bool is_loaded(const char *path) {
+    return path_set_contains(&loaded_goog_paths, path);
 }
 
-void add_loaded_hash(unsigned long h) {
-    if (count_loaded_goog_hashes < 2048) {
-        loaded_goog_hashes[count_loaded_goog_hashes++] = h;
-    }
+void add_loaded_path(const char *path) {
+    path_set_add(&loaded_goog_paths, path);
 }
 #endif
 
@@ -778,3 +765,144 @@ JSValueRef function_sleep(JSContextRef ctx, JSObjectRef function, JSObjectRef th
     }
     return JSValueMakeNull(ctx);
 }
+
+static void set_number_property(JSContextRef ctx, JSObjectRef obj, char *name, double value) {
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSObjectSetProperty(ctx, obj, name_str, JSValueMakeNumber(ctx, value), kJSPropertyAttributeReadOnly, NULL);
+    JSStringRelease(name_str);
+}
+
+JSValueRef function_bundle_cache_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                       size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    struct bundle_cache_stats stats;
+    bundle_cache_get_stats(&stats);
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_number_property(ctx, result, "hits", (double) stats.hits);
+    set_number_property(ctx, result, "misses", (double) stats.misses);
+    set_number_property(ctx, result, "evictions", (double) stats.evictions);
+    set_number_property(ctx, result, "entries", (double) stats.entries);
+    set_number_property(ctx, result, "bytes", (double) stats.bytes);
+    set_number_property(ctx, result, "budget", (double) stats.budget);
+    set_number_property(ctx, result, "allocations", (double) stats.allocations);
+    set_number_property(ctx, result, "allocated-bytes", (double) stats.allocated_bytes);
+    return result;
+}
+
+JSValueRef function_bundle_load_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                      size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    struct bundle_load_stats stats;
+    bundle_get_load_stats(&stats);
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_number_property(ctx, result, "scripts", (double) stats.scripts);
+    set_number_property(ctx, result, "cache-hits", (double) stats.cache_hits);
+    set_number_property(ctx, result, "arena-loads", (double) stats.arena_loads);
+    set_number_property(ctx, result, "heap-loads", (double) stats.heap_loads);
+    set_number_property(ctx, result, "arena-grows", (double) stats.arena_grows);
+    set_number_property(ctx, result, "arena-bytes", (double) stats.arena_bytes);
+    return result;
+}
+
+JSValueRef function_trace_start(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    trace_start();
+    return JSValueMakeUndefined(ctx);
+}
+
+// Writes the spans recorded since REPLETE_TRACE_START to path, relative to
+// the sandbox root, for loading into a trace viewer.
+JSValueRef function_trace_stop(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeString) {
+        char *path = value_to_c_string(ctx, args[0]);
+        bool written = trace_stop(sandbox(path));
+        free(path);
+        return JSValueMakeBoolean(ctx, written);
+    }
+    return JSValueMakeBoolean(ctx, false);
+}
+
+static void set_histogram_property(JSContextRef ctx, JSObjectRef obj, const char *name,
+                                   const unsigned long *buckets, int count) {
+    JSValueRef values[count];
+    int i;
+    for (i = 0; i < count; i++) {
+        values[i] = JSValueMakeNumber(ctx, (double) buckets[i]);
+    }
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSObjectSetProperty(ctx, obj, name_str, JSObjectMakeArray(ctx, count, values, NULL),
+                        kJSPropertyAttributeNone, NULL);
+    JSStringRelease(name_str);
+}
+
+JSValueRef function_timer_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    struct timer_stats stats;
+    timer_get_stats(&stats);
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_number_property(ctx, result, "batches", (double) stats.batches);
+    set_number_property(ctx, result, "fired", (double) stats.fired);
+    set_number_property(ctx, result, "max-batch", (double) stats.max_batch);
+    set_number_property(ctx, result, "pending", (double) stats.pending);
+    set_histogram_property(ctx, result, "batch-sizes", stats.batch_sizes, TIMER_BATCH_BUCKETS);
+    return result;
+}
+
+// What the JS thread has been doing: how long tasks waited to start and
+// ran for, in power-of-two microsecond buckets, time spent per kind of
+// task, and what is running now.
+JSValueRef function_js_thread_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    struct js_thread_stats stats;
+    js_thread_get_stats(&stats);
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_number_property(ctx, result, "tasks", (double) stats.tasks);
+    set_number_property(ctx, result, "microtasks", (double) stats.microtasks);
+    set_number_property(ctx, result, "queued", (double) stats.queued);
+    set_number_property(ctx, result, "max-queued", (double) stats.max_queued);
+    set_number_property(ctx, result, "contended", (double) stats.contended);
+    set_histogram_property(ctx, result, "wait-micros", stats.wait_micros, JS_THREAD_HISTOGRAM_BUCKETS);
+    set_histogram_property(ctx, result, "run-micros", stats.run_micros, JS_THREAD_HISTOGRAM_BUCKETS);
+    
+    JSObjectRef kinds = JSObjectMake(ctx, NULL, NULL);
+    int kind;
+    for (kind = 0; kind < JS_TASK_KINDS; kind++) {
+        JSObjectRef kind_stats = JSObjectMake(ctx, NULL, NULL);
+        set_number_property(ctx, kind_stats, "tasks", (double) stats.kind_tasks[kind]);
+        set_number_property(ctx, kind_stats, "run-micros", stats.kind_run_micros[kind]);
+        JSStringRef kind_str = JSStringCreateWithUTF8CString(js_task_kind_name(kind));
+        JSObjectSetProperty(ctx, kinds, kind_str, kind_stats, kJSPropertyAttributeNone, NULL);
+        JSStringRelease(kind_str);
+    }
+    JSStringRef kinds_str = JSStringCreateWithUTF8CString("kinds");
+    JSObjectSetProperty(ctx, result, kinds_str, kinds, kJSPropertyAttributeNone, NULL);
+    JSStringRelease(kinds_str);
+    
+    // Reports itself, since it is what is running.
+    if (stats.running) {
+        JSObjectRef current = JSObjectMake(ctx, NULL, NULL);
+        JSStringRef kind_str = JSStringCreateWithUTF8CString("kind");
+        JSObjectSetProperty(ctx, current, kind_str, c_string_to_value(ctx, js_task_kind_name(stats.current)),
+                            kJSPropertyAttributeNone, NULL);
+        JSStringRelease(kind_str);
+        set_number_property(ctx, current, "micros", stats.current_micros);
+        JSStringRef current_str = JSStringCreateWithUTF8CString("current");
+        JSObjectSetProperty(ctx, result, current_str, current, kJSPropertyAttributeNone, NULL);
+        JSStringRelease(current_str);
+    }
+    return result;
+}
+
+// Sets how many seconds later evaluations may run before being stopped;
+// 0 lifts the limit. Returns the previous limit.
+JSValueRef function_set_time_limit(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                   size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    double previous = watchdog_get_limit();
+    if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
+        watchdog_set_limit(JSValueToNumber(ctx, args[0], NULL));
+    }
+    return JSValueMakeNumber(ctx, previous);
+}
@@ -1,5 +1,7 @@
 void set_root_directory(const char* path);
 
+const char* sandbox(const char* path);
+
 JSValueRef function_console_stdout(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object, size_t argc,
                                    JSValueRef const *args, JSValueRef *exception);
 
@@ -158,3 +160,24 @@ JSValueRef function_signal_task_complete(JSContextRef ctx, JSObjectRef function,
 
 JSValueRef function_getenv(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
                            size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_bundle_cache_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                       size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_bundle_load_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                      size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_trace_start(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_trace_stop(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_timer_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_js_thread_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                    size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_set_time_limit(JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+                                   size_t argc, const JSValueRef args[], JSValueRef *exception);
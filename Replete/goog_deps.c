@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "goog_deps.h"
+
+// Reads the dependency graph out of the goog.addDependency calls the
+// ClojureScript compiler and Closure Library emit. Used at runtime by the
+// bundle prefetcher and at bundle time by script/startup_image.c, so it
+// only depends on libc.
+
+// Open addressing, namespace to dependency index.
+struct name_table {
+    const char **keys;
+    size_t *values;
+    size_t capacity;
+};
+
+static unsigned long hash_name(const char *name) {
+    unsigned long h = 2166136261UL;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static bool name_table_init(struct name_table *table, size_t count) {
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    table->keys = calloc(capacity, sizeof(char *));
+    table->values = calloc(capacity, sizeof(size_t));
+    table->capacity = capacity;
+    return table->keys != NULL && table->values != NULL;
+}
+
+static void name_table_free(struct name_table *table) {
+    free(table->keys);
+    free(table->values);
+}
+
+// Keeps the first value put for a key.
+static void name_table_put(struct name_table *table, const char *key, size_t value) {
+    size_t i = hash_name(key) & (table->capacity - 1);
+    while (table->keys[i]) {
+        if (strcmp(table->keys[i], key) == 0) {
+            return;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->keys[i] = key;
+    table->values[i] = value;
+}
+
+static bool name_table_get(struct name_table *table, const char *key, size_t *value) {
+    size_t i = hash_name(key) & (table->capacity - 1);
+    while (table->keys[i]) {
+        if (strcmp(table->keys[i], key) == 0) {
+            *value = table->values[i];
+            return true;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return false;
+}
+
+static const char *skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+        p++;
+    }
+    return p;
+}
+
+static const char *skip_comma(const char *p) {
+    p = skip_space(p);
+    return *p == ',' ? p + 1 : NULL;
+}
+
+// Parses a quoted JS string literal (no escapes) into *out.
+static const char *parse_string(const char *p, char **out) {
+    p = skip_space(p);
+    char quote = *p;
+    if (quote != '"' && quote != '\'') {
+        return NULL;
+    }
+    const char *end = strchr(p + 1, quote);
+    if (end == NULL) {
+        return NULL;
+    }
+    *out = strndup(p + 1, end - p - 1);
+    return end + 1;
+}
+
+static const char *parse_string_list(const char *p, char ***out, size_t *count) {
+    p = skip_space(p);
+    if (*p != '[') {
+        return NULL;
+    }
+    p = skip_space(p + 1);
+
+    size_t capacity = 4;
+    *out = malloc(capacity * sizeof(char *));
+    *count = 0;
+    while (*p != ']') {
+        char *s = NULL;
+        p = parse_string(p, &s);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            *out = realloc(*out, capacity * sizeof(char *));
+        }
+        (*out)[(*count)++] = s;
+        p = skip_space(p);
+        if (*p == ',') {
+            p = skip_space(p + 1);
+        }
+    }
+    return p + 1;
+}
+
+static const char *find_within(const char *p, const char *end, const char *s) {
+    size_t len = strlen(s);
+    for (; p + len <= end; p++) {
+        if (memcmp(p, s, len) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// The optional load flags object, e.g. {'module': 'goog', 'lang': 'es6'}.
+// Only whether the file is a goog.module matters here.
+static const char *parse_load_flags(const char *p, bool *module) {
+    const char *end = strchr(p, ')');
+    if (end == NULL) {
+        return p;
+    }
+    const char *flag = find_within(p, end, "module");
+    if (flag != NULL && find_within(flag, end, "goog") != NULL) {
+        *module = true;
+    }
+    return end;
+}
+
+// Dependency paths are relative to goog/, the way CLOSURE_IMPORT_SCRIPT
+// hands them to AMBLY_IMPORT_SCRIPT.
+static char *resolve_path(const char *path) {
+    if (strncmp(path, "../", 3) == 0) {
+        return strdup(path + 3);
+    }
+    char *resolved = malloc(strlen("goog/") + strlen(path) + 1);
+    strcpy(resolved, "goog/");
+    strcat(resolved, path);
+    return resolved;
+}
+
+static void free_dependency(struct goog_dependency *dep) {
+    size_t i;
+    free(dep->path);
+    for (i = 0; i < dep->provides_count; i++) {
+        free(dep->provides[i]);
+    }
+    free(dep->provides);
+    for (i = 0; i < dep->requires_count; i++) {
+        free(dep->requires[i]);
+    }
+    free(dep->requires);
+}
+
+// Adds the dependencies declared in text to deps. Where two declare the
+// same namespace, the one parsed first wins.
+void goog_deps_parse(struct goog_deps *deps, const char *text) {
+    const char *p = text;
+    while ((p = strstr(p, "goog.addDependency(")) != NULL) {
+        p += strlen("goog.addDependency(");
+
+        struct goog_dependency dep;
+        memset(&dep, 0, sizeof(dep));
+        char *path = NULL;
+        const char *q = parse_string(p, &path);
+        if (q) q = skip_comma(q);
+        if (q) q = parse_string_list(q, &dep.provides, &dep.provides_count);
+        if (q) q = skip_comma(q);
+        if (q) q = parse_string_list(q, &dep.requires, &dep.requires_count);
+        if (q == NULL) {
+            // Not a literal call (goog/base.js defines the function itself).
+            free(path);
+            free_dependency(&dep);
+            continue;
+        }
+        q = parse_load_flags(q, &dep.module);
+
+        dep.path = resolve_path(path);
+        free(path);
+        if (deps->count == deps->capacity) {
+            deps->capacity = deps->capacity ? deps->capacity * 2 : 256;
+            deps->deps = realloc(deps->deps, deps->capacity * sizeof(struct goog_dependency));
+        }
+        deps->deps[deps->count++] = dep;
+        p = q;
+    }
+}
+
+static void visit(struct goog_deps *deps, struct name_table *provided, bool *visited,
+                  size_t index, size_t *order, size_t *count) {
+    if (visited[index]) {
+        return;
+    }
+    visited[index] = true;
+
+    struct goog_dependency *dep = &deps->deps[index];
+    size_t i;
+    for (i = 0; i < dep->requires_count; i++) {
+        size_t required;
+        if (name_table_get(provided, dep->requires[i], &required)) {
+            visit(deps, provided, visited, required, order, count);
+        }
+    }
+    order[(*count)++] = index;
+}
+
+// Returns the indexes of the dependencies providing roots and everything
+// they transitively require, in load order (each after what it requires).
+// The caller frees the result.
+size_t *goog_deps_closure(struct goog_deps *deps, const char **roots, size_t root_count, size_t *count) {
+    *count = 0;
+
+    size_t provide_count = 0;
+    size_t i, j;
+    for (i = 0; i < deps->count; i++) {
+        provide_count += deps->deps[i].provides_count;
+    }
+
+    struct name_table provided;
+    bool *visited = calloc(deps->count ? deps->count : 1, sizeof(bool));
+    size_t *order = malloc((deps->count ? deps->count : 1) * sizeof(size_t));
+    if (!name_table_init(&provided, provide_count) || !visited || !order) {
+        name_table_free(&provided);
+        free(visited);
+        free(order);
+        return NULL;
+    }
+
+    for (i = 0; i < deps->count; i++) {
+        for (j = 0; j < deps->deps[i].provides_count; j++) {
+            name_table_put(&provided, deps->deps[i].provides[j], i);
+        }
+    }
+
+    for (i = 0; i < root_count; i++) {
+        size_t root;
+        if (name_table_get(&provided, roots[i], &root)) {
+            visit(deps, &provided, visited, root, order, count);
+        }
+    }
+
+    name_table_free(&provided);
+    free(visited);
+    return order;
+}
+
+void goog_deps_free(struct goog_deps *deps) {
+    size_t i;
+    for (i = 0; i < deps->count; i++) {
+        free_dependency(&deps->deps[i]);
+    }
+    free(deps->deps);
+    deps->deps = NULL;
+    deps->count = 0;
+    deps->capacity = 0;
+}
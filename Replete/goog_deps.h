@@ -0,0 +1,25 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// A goog.addDependency call from main.js or goog/deps.js, with its path
+// resolved from goog/-relative to a bundle path.
+struct goog_dependency {
+    char *path;
+    char **provides;
+    size_t provides_count;
+    char **requires;
+    size_t requires_count;
+    bool module;
+};
+
+struct goog_deps {
+    struct goog_dependency *deps;
+    size_t count;
+    size_t capacity;
+};
+
+void goog_deps_parse(struct goog_deps *deps, const char *text);
+
+size_t *goog_deps_closure(struct goog_deps *deps, const char **roots, size_t root_count, size_t *count);
+
+void goog_deps_free(struct goog_deps *deps);
@@ -1,8 +1,11 @@
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <strings.h>
+#include <sys/stat.h>
 
 #include <JavaScriptCore/JavaScript.h>
 
@@ -11,119 +14,602 @@
 //#include "engine.h"
 extern JSGlobalContextRef ctx;
 #include "jsc_utils.h"
+#include "http_pool.h"
+#include "http_io.h"
+#include "js_thread.h"
+#include "watchdog.h"
+#include "functions.h"
+#include "http_cache.h"
+#include "http_response.h"
 
 #ifndef CURL_VERSION_UNIX_SOCKETS
 #define CURL_VERSION_UNIX_SOCKETS 0
 #define CURLOPT_UNIX_SOCKET_PATH 0
 #endif
 
-static const char* ca_root_path;
-
 void set_ca_root_path(const char* path) {
-    ca_root_path = path;
+    http_pool_set_ca_path(path);
 }
 
-struct header_state {
-    JSObjectRef *headers;
-};
-
 int curl_has_feature(int feature_const) {
     curl_version_info_data *data = curl_version_info(CURLVERSION_NOW);
     return data->features & feature_const;
 }
 
-size_t header_to_object_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
-    struct header_state *state = (struct header_state *) userdata;
+// Presizing from Content-Length stops short of this, in case the header is
+// wrong; the buffer grows past it if need be.
+#define MAX_PRESIZE (64 * 1024 * 1024)
+
+struct write_state {
+    size_t offset;
+    size_t length;
+    char *data;
+    // Set for the body, to presize it from Content-Length.
+    CURL *handle;
+};
+
+static bool reserve(struct write_state *state, size_t length) {
+    if (length <= state->length) {
+        return true;
+    }
+    size_t new_length = state->length * 2 + CURL_MAX_WRITE_SIZE;
+    if (state->length == 0) {
+        new_length += 1; // nul-byte
+    }
+    // Header lines can be longer than CURL_MAX_WRITE_SIZE.
+    while (new_length < length) {
+        new_length *= 2;
+    }
+    char *data = realloc(state->data, new_length);
+    if (data == NULL) {
+        return false;
+    }
+    state->data = data;
+    state->length = new_length;
+    return true;
+}
+
+size_t write_string_callback(char *buffer, size_t size, size_t nmemb, void
+                             *userdata) {
+    struct write_state *state = (struct write_state *) userdata;
+    
+    if (state->length == 0 && state->handle != NULL) {
+        curl_off_t content_length = -1;
+        curl_easy_getinfo(state->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+        if (content_length > 0 && content_length < MAX_PRESIZE) {
+            reserve(state, (size_t) content_length + 1);
+        }
+    }
+    
+    // Returning short fails the transfer.
+    if (!reserve(state, state->offset + size * nmemb + 1)) {
+        return 0;
+    }
     
-    // printf("'%s'\n", buffer);
+    memcpy(state->data + state->offset, buffer, size * nmemb);
+    state->offset += size * nmemb;
+    state->data[state->offset] = '\0';
     
-    int key_end = -1;
-    size_t val_end = size * nitems;
+    return size * nmemb;
+}
+
+static JSValueRef get_property(JSContextRef ctx, JSObjectRef obj, const char *name) {
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSValueRef value = JSObjectGetProperty(ctx, obj, name_str, NULL);
+    JSStringRelease(name_str);
+    return value;
+}
+
+static void set_property(JSContextRef ctx, JSObjectRef obj, const char *name, JSValueRef value) {
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSObjectSetProperty(ctx, obj, name_str, value, kJSPropertyAttributeReadOnly, NULL);
+    JSStringRelease(name_str);
+}
+
+static void set_error(JSContextRef ctx, JSObjectRef result, const char *message) {
+    JSStringRef error_str = JSStringCreateWithUTF8CString(message);
+    set_property(ctx, result, "error", JSValueMakeString(ctx, error_str));
+    JSStringRelease(error_str);
+}
+
+// One request, from its options through to its response.
+struct http_request {
+    CURL *handle;
+    struct curl_slist *headers;
+    // The body is one of these, or none.
+    char *body;
+    JSObjectRef body_bytes;
+    FILE *body_file;
+    bool binary_response;
+    struct write_state response_headers;
+    struct write_state response_body;
+    CURLcode result;
+    // Async requests only.
+    bool async;
+    unsigned long io_id;
+    JSObjectRef callback;
+    // Streamed bodies, which never collect in response_body, go either to
+    // on_chunk or to output_file.
+    JSObjectRef on_chunk;
+    FILE *output_file;
+    pthread_mutex_t chunk_lock;
+    size_t pending_chunk_bytes;
+    bool paused;
+    // The start of a UTF-8 sequence split across chunks.
+    char carry[4];
+    size_t carry_length;
+    // Set for GETs that may use the HTTP cache; entry is what was cached,
+    // if anything. A fresh entry is served without a transfer.
+    char *cache_url;
+    struct http_cache_entry *cache_entry;
+    // Decided once, when the entry is looked up, so an entry that goes
+    // stale while the response waits its turn is still the response.
+    bool served_from_cache;
+    // Body bytes streamed out, after decompression.
+    size_t streamed_bytes;
+};
+
+// An async transfer stops reading while this much has been received but
+// not yet handed to on_chunk, so a slow consumer bounds memory use.
+#define MAX_PENDING_CHUNK_BYTES (1024 * 1024)
+
+static void http_request_free(struct http_request *request) {
+    http_pool_release(request->handle);
+    if (request->on_chunk != NULL) {
+        JSValueUnprotect(ctx, request->on_chunk);
+    }
+    if (request->output_file != NULL) {
+        fclose(request->output_file);
+    }
+    pthread_mutex_destroy(&request->chunk_lock);
+    free(request->cache_url);
+    http_cache_entry_free(request->cache_entry);
+    curl_slist_free_all(request->headers);
+    free(request->body);
+    if (request->body_bytes != NULL) {
+        JSValueUnprotect(ctx, request->body_bytes);
+    }
+    if (request->body_file != NULL) {
+        fclose(request->body_file);
+    }
+    free(request->response_headers.data);
+    free(request->response_body.data);
+    free(request);
+}
+
+static void free_bytes(void *bytes, void *context) {
+    free(bytes);
+}
+
+// How much of length ends in a UTF-8 sequence that continues in the next
+// chunk.
+static size_t incomplete_utf8_tail(const char *bytes, size_t length) {
     size_t i;
-    for (i = 0; i < size * nitems; i++) {
-        if (buffer[i] == ':' && key_end == -1) {
-            key_end = i;
-        }
-        
-        if (buffer[i] == '\r' && buffer[i + 1] == '\n') {
-            val_end = i;
+    for (i = 1; i <= 3 && i <= length; i++) {
+        unsigned char c = (unsigned char) bytes[length - i];
+        if ((c & 0xC0) == 0x80) {
+            continue;
         }
+        size_t needed = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return needed > i ? i : 0;
+    }
+    return 0;
+}
+
+struct chunk {
+    struct http_request *request;
+    size_t length;
+    char bytes[];
+};
+
+static void free_chunk(void *bytes, void *context) {
+    free(context);
+}
+
+// On the JS thread. Passes on_chunk the next piece of the body: a
+// Uint8Array over the chunk for binary responses, otherwise a string,
+// holding back any UTF-8 sequence cut off at the end for the next chunk.
+// Takes over chunk.
+static void call_on_chunk(struct http_request *request, struct chunk *chunk) {
+    JSValueRef args[1];
+    if (request->binary_response) {
+        args[0] = JSObjectMakeTypedArrayWithBytesNoCopy(ctx, kJSTypedArrayTypeUint8Array, chunk->bytes, chunk->length,
+                                                       free_chunk, chunk, NULL);
+    } else {
+        size_t total = request->carry_length + chunk->length;
+        char *text = malloc(total + 1);
+        memcpy(text, request->carry, request->carry_length);
+        memcpy(text + request->carry_length, chunk->bytes, chunk->length);
+        free(chunk);
+        size_t tail = incomplete_utf8_tail(text, total);
+        memcpy(request->carry, text + total - tail, tail);
+        request->carry_length = tail;
+        text[total - tail] = '\0';
+        JSStringRef text_str = JSStringCreateWithUTF8CString(text);
+        args[0] = JSValueMakeString(ctx, text_str);
+        JSStringRelease(text_str);
+        free(text);
     }
-    if (key_end == -1) { // likely empty?
-        return size * nitems;
+    JSObjectCallAsFunction(ctx, request->on_chunk, NULL, 1, args, NULL);
+}
+
+// On the JS thread, once the body has ended. A UTF-8 sequence still held
+// back then was cut short, so on_chunk gets U+FFFD in its place rather
+// than the bytes going missing without a trace.
+static void flush_carry(struct http_request *request) {
+    if (request->on_chunk == NULL || request->carry_length == 0) {
+        return;
     }
+    request->carry_length = 0;
+    JSValueRef args[1];
+    JSStringRef replacement_str = JSStringCreateWithUTF8CString("\xEF\xBF\xBD");
+    args[0] = JSValueMakeString(ctx, replacement_str);
+    JSStringRelease(replacement_str);
+    JSObjectCallAsFunction(ctx, request->on_chunk, NULL, 1, args, NULL);
+}
+
+static void deliver_chunk(void *data) {
+    struct chunk *chunk = data;
+    struct http_request *request = chunk->request;
+    size_t length = chunk->length;
     
-    char key[key_end + 1];
-    strncpy(key, buffer, key_end);
-    key[key_end] = '\0';
+    watchdog_begin();
+    call_on_chunk(request, chunk);
+    watchdog_end();
     
-    JSStringRef key_str = JSStringCreateWithUTF8CString(key);
+    pthread_mutex_lock(&request->chunk_lock);
+    request->pending_chunk_bytes -= length;
+    bool resume = request->paused && request->pending_chunk_bytes <= MAX_PENDING_CHUNK_BYTES / 2;
+    if (resume) {
+        request->paused = false;
+    }
+    pthread_mutex_unlock(&request->chunk_lock);
+    if (resume) {
+        http_io_resume(request->io_id);
+    }
+}
+
+size_t write_chunk_callback(char *buffer, size_t size, size_t nmemb, void *userdata) {
+    struct http_request *request = (struct http_request *) userdata;
+    size_t length = size * nmemb;
     
-    int val_start = key_end + 1;
+    // Async, this is the I/O thread, and the chunk goes to the JS thread.
+    if (request->async) {
+        pthread_mutex_lock(&request->chunk_lock);
+        if (request->pending_chunk_bytes >= MAX_PENDING_CHUNK_BYTES) {
+            request->paused = true;
+            pthread_mutex_unlock(&request->chunk_lock);
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        request->pending_chunk_bytes += length;
+        pthread_mutex_unlock(&request->chunk_lock);
+    }
+    request->streamed_bytes += length;
     
-    // Trim whitespace from beginning of val
-    for (i = val_start; i < val_end; i++) {
-        if (buffer[i] == ' ' || buffer[i] == '\t') {
-            val_start++;
+    struct chunk *chunk = malloc(sizeof(struct chunk) + length);
+    if (chunk == NULL) {
+        return 0;
+    }
+    chunk->request = request;
+    chunk->length = length;
+    memcpy(chunk->bytes, buffer, length);
+    if (request->async) {
+        js_thread_post(JS_TASK_IO, deliver_chunk, chunk);
+    } else {
+        call_on_chunk(request, chunk);
+    }
+    return length;
+}
+
+size_t read_file_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
+    FILE *f = (FILE *) userdata;
+    size_t read = fread(buffer, 1, size * nitems, f);
+    if (read == 0 && ferror(f)) {
+        return CURL_READFUNC_ABORT;
+    }
+    return read;
+}
+
+size_t write_file_callback(char *buffer, size_t size, size_t nmemb, void *userdata) {
+    struct http_request *request = (struct http_request *) userdata;
+    size_t written = fwrite(buffer, size, nmemb, request->output_file) * size;
+    request->streamed_bytes += written;
+    return written;
+}
+
+// Sets up a handle from the options REPLETE_REQUEST takes. Returns NULL,
+// with error set, if the options can't be honored.
+static struct http_request *http_request_create(JSContextRef ctx, JSObjectRef opts, bool async, const char **error) {
+    CURL *handle = http_pool_acquire(async);
+    if (handle == NULL) {
+        *error = "Couldn't create a curl handle.";
+        return NULL;
+    }
+    
+    struct http_request *request = calloc(1, sizeof(struct http_request));
+    request->handle = handle;
+    request->result = CURLE_OK;
+    request->async = async;
+    pthread_mutex_init(&request->chunk_lock, NULL);
+    
+    char *socket = NULL;
+    JSValueRef socket_ref = get_property(ctx, opts, "socket");
+    if (!JSValueIsUndefined(ctx, socket_ref)) {
+        if (curl_has_feature(CURL_VERSION_UNIX_SOCKETS)) {
+            socket = value_to_c_string(ctx, socket_ref);
+            curl_easy_setopt(handle, CURLOPT_UNIX_SOCKET_PATH, socket);
+            free(socket);
         } else {
-            break;
+            *error = "This version of libcurl does not support UNIX sockets.";
+            http_request_free(request);
+            return NULL;
+        }
+    }
+    
+    // curl copies strings it's given, except for the body.
+    char *url = value_to_c_string(ctx, get_property(ctx, opts, "url"));
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    
+    char *method = value_to_c_string(ctx, get_property(ctx, opts, "method"));
+    curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, method);
+    bool get = method == NULL || strcasecmp(method, "GET") == 0;
+    free(method);
+    
+    JSValueRef timeout_ref = get_property(ctx, opts, "timeout");
+    time_t timeout = 0;
+    if (JSValueIsNumber(ctx, timeout_ref)) {
+        timeout = (time_t) JSValueToNumber(ctx, timeout_ref, NULL);
+    }
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT, timeout);
+    
+    JSValueRef binary_response_ref = get_property(ctx, opts, "binary-response");
+    if (JSValueIsBoolean(ctx, binary_response_ref)) {
+        request->binary_response = JSValueToBoolean(ctx, binary_response_ref);
+    }
+    
+    JSValueRef user_agent_ref = get_property(ctx, opts, "user-agent");
+    if (!JSValueIsUndefined(ctx, user_agent_ref)) {
+        char *user_agent = value_to_c_string(ctx, user_agent_ref);
+        curl_easy_setopt(handle, CURLOPT_USERAGENT, user_agent);
+        free(user_agent);
+    }
+    
+    JSValueRef follow_redirects_ref = get_property(ctx, opts, "follow-redirects");
+    if (JSValueIsBoolean(ctx, follow_redirects_ref)) {
+        if (JSValueToBoolean(ctx, follow_redirects_ref)) {
+            curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
+            
+            JSValueRef max_redirects_ref = get_property(ctx, opts, "max-redirects");
+            if (JSValueIsNumber(ctx, max_redirects_ref)) {
+                long max_redirects = (long)JSValueToNumber(ctx, max_redirects_ref, NULL);
+                curl_easy_setopt(handle, CURLOPT_MAXREDIRS, max_redirects);
+            }
         }
-     }
+    }
+    
+    // HTTP/2 where the server offers it over TLS, so that concurrent async
+    // requests to one origin share a connection, waiting for it if need
+    // be rather than opening another.
+    JSValueRef http2_ref = get_property(ctx, opts, "http2");
+    if (JSValueIsBoolean(ctx, http2_ref) && !JSValueToBoolean(ctx, http2_ref)) {
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_1_1);
+    } else {
+        curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    }
+    
+    // An empty Accept-Encoding asks for every encoding this curl can
+    // decode (gzip and deflate, and br if built with brotli), and bodies
+    // are decoded before anything sees them.
+    JSValueRef compressed_ref = get_property(ctx, opts, "compressed");
+    if (!JSValueIsBoolean(ctx, compressed_ref) || JSValueToBoolean(ctx, compressed_ref)) {
+        curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    }
     
-    // Trim whitespace from end of val
-    for (i = val_end - 1; i > val_start; i--) {
-        if (buffer[i] == ' ' || buffer[i] == '\t') {
-            val_end--;
+    JSValueRef insecure_ref = get_property(ctx, opts, "insecure");
+    if (JSValueIsBoolean(ctx, insecure_ref) && JSValueToBoolean(ctx, insecure_ref)) {
+        curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+    
+    JSObjectRef headers_obj = JSValueToObject(ctx, get_property(ctx, opts, "headers"), NULL);
+    if (headers_obj != NULL && !JSValueIsNull(ctx, headers_obj)) {
+        JSPropertyNameArrayRef properties = JSObjectCopyPropertyNames(ctx, headers_obj);
+        size_t n = JSPropertyNameArrayGetCount(properties);
+        size_t i;
+        for (i = 0; i < n; i++) {
+            JSStringRef key_str = JSPropertyNameArrayGetNameAtIndex(properties, i);
+            JSValueRef val_ref = JSObjectGetProperty(ctx, headers_obj, key_str, NULL);
+            
+            size_t len = JSStringGetMaximumUTF8CStringSize(key_str);
+            char *key = malloc(len * sizeof(char));
+            JSStringGetUTF8CString(key_str, key, len);
+            JSStringRef val_as_str = to_string(ctx, val_ref);
+            char *val = value_to_c_string(ctx, JSValueMakeString(ctx, val_as_str));
+            JSStringRelease(val_as_str);
+            
+            size_t len_key = strlen(key);
+            size_t len_val = strlen(val);
+            char *header = malloc((len_key + len_val + 2 + 1) * sizeof(char));
+            sprintf(header, "%s: %s", key, val);
+            request->headers = curl_slist_append(request->headers, header);
+            free(header);
+            
+            free(key);
+            free(val);
+        }
+        JSPropertyNameArrayRelease(properties);
+        
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, request->headers);
+    }
+    
+    // A Uint8Array or ArrayBuffer body is sent from where it is, so it
+    // shouldn't be changed until the request is done. A body-file, under
+    // the sandbox root, is read as it is sent.
+    JSValueRef body_ref = get_property(ctx, opts, "body");
+    JSValueRef body_file_ref = get_property(ctx, opts, "body-file");
+    JSTypedArrayType body_type = JSValueGetTypedArrayType(ctx, body_ref, NULL);
+    if (body_type == kJSTypedArrayTypeUint8Array || body_type == kJSTypedArrayTypeArrayBuffer) {
+        request->body_bytes = JSValueToObject(ctx, body_ref, NULL);
+        JSValueProtect(ctx, request->body_bytes);
+        char *bytes;
+        size_t length;
+        if (body_type == kJSTypedArrayTypeArrayBuffer) {
+            bytes = JSObjectGetArrayBufferBytesPtr(ctx, request->body_bytes, NULL);
+            length = JSObjectGetArrayBufferByteLength(ctx, request->body_bytes, NULL);
         } else {
-            break;
+            bytes = (char *) JSObjectGetTypedArrayBytesPtr(ctx, request->body_bytes, NULL)
+                    + JSObjectGetTypedArrayByteOffset(ctx, request->body_bytes, NULL);
+            length = JSObjectGetTypedArrayByteLength(ctx, request->body_bytes, NULL);
+        }
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) length);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, bytes);
+    } else if (JSValueGetType(ctx, body_file_ref) == kJSTypeString) {
+        char *path = value_to_c_string(ctx, body_file_ref);
+        request->body_file = fopen(sandbox(path), "rb");
+        free(path);
+        if (request->body_file == NULL) {
+            *error = "Couldn't open body-file for reading.";
+            free(url);
+            http_request_free(request);
+            return NULL;
         }
+        curl_easy_setopt(handle, CURLOPT_POST, 1L);
+        curl_easy_setopt(handle, CURLOPT_READDATA, request->body_file);
+        curl_easy_setopt(handle, CURLOPT_READFUNCTION, read_file_callback);
+        // Without a length, curl sends the file chunked.
+        struct stat st;
+        if (fstat(fileno(request->body_file), &st) == 0 && S_ISREG(st.st_mode)) {
+            curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) st.st_size);
+        }
+    } else if (!JSValueIsUndefined(ctx, body_ref)) {
+        request->body = value_to_c_string(ctx, body_ref);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) strlen(request->body));
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, request->body);
     }
     
-    size_t val_len;
-    JSStringRef val_str;
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &request->response_headers);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, write_string_callback);
     
-    if (val_start < val_end) {
-        val_len = val_end - val_start;
-        char val[val_len + 1];
-        strncpy(val, buffer + val_start, val_len);
-        val[val_len] = '\0';
-        val_str = JSStringCreateWithUTF8CString(val);
+    // The body goes to a file under the sandbox root, or chunk by chunk to
+    // a function, or else is collected for the response.
+    JSValueRef output_file_ref = get_property(ctx, opts, "output-file");
+    JSValueRef on_chunk_ref = get_property(ctx, opts, "on-chunk");
+    if (JSValueGetType(ctx, output_file_ref) == kJSTypeString) {
+        char *path = value_to_c_string(ctx, output_file_ref);
+        request->output_file = fopen(sandbox(path), "wb");
+        free(path);
+        if (request->output_file == NULL) {
+            *error = "Couldn't open output-file for writing.";
+            free(url);
+            http_request_free(request);
+            return NULL;
+        }
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, request);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_file_callback);
+    } else if (JSValueIsObject(ctx, on_chunk_ref)) {
+        request->on_chunk = JSValueToObject(ctx, on_chunk_ref, NULL);
+        JSValueProtect(ctx, request->on_chunk);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, request);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_chunk_callback);
     } else {
-          char val[1];
-          val[0] = '\0';
-          val_str = JSStringCreateWithUTF8CString(val);
+        request->response_body.handle = handle;
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &request->response_body);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_string_callback);
+        
+        // Only whole GET responses collected in memory are cached.
+        JSValueRef cache_ref = get_property(ctx, opts, "cache");
+        if (get && url != NULL && JSValueIsBoolean(ctx, cache_ref) && JSValueToBoolean(ctx, cache_ref)
+            && request->body == NULL && request->body_bytes == NULL && request->body_file == NULL) {
+            request->cache_url = url;
+            url = NULL;
+            request->cache_entry = http_cache_lookup(request->cache_url, request->headers);
+            request->served_from_cache = request->cache_entry != NULL && http_cache_is_fresh(request->cache_entry);
+            if (request->cache_entry != NULL && !request->served_from_cache) {
+                struct curl_slist *headers = http_cache_add_validators(request->cache_entry, request->headers);
+                if (headers != NULL) {
+                    request->headers = headers;
+                    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, request->headers);
+                }
+            }
+        }
     }
-    JSValueRef val_ref = JSValueMakeString(ctx, val_str);
-    
-    JSObjectSetProperty(ctx, *state->headers, key_str, val_ref, kJSPropertyAttributeReadOnly, NULL);
+    free(url);
     
-    return size * nitems;
+    return request;
 }
 
-struct write_state {
-    int offset;
-    int length;
-    char *data;
-};
-
-size_t write_string_callback(char *buffer, size_t size, size_t nmemb, void
-                             *userdata) {
-    struct write_state *state = (struct write_state *) userdata;
+// The object REPLETE_REQUEST returns, once the transfer is done. A
+// binary-response body is a Uint8Array; a streamed one is left out.
+static JSObjectRef http_response_object(JSContextRef ctx, struct http_request *request) {
+    struct http_response response = {0};
     
-    if (state->length - state->offset < size * nmemb) {
-        int new_length = state->length * 2 + CURL_MAX_WRITE_SIZE;
-        if (state->length == 0) {
-            new_length += 1; // nul-byte
+    // Closed now so the file is complete by the time anyone looks.
+    bool file_error = false;
+    if (request->output_file != NULL) {
+        file_error = fclose(request->output_file) != 0;
+        request->output_file = NULL;
+    }
+    
+    if (request->result == CURLE_ABORTED_BY_CALLBACK) {
+        response.error = "Request cancelled.";
+    } else if (request->result != CURLE_OK) {
+        response.error = curl_easy_strerror(request->result);
+    } else if (file_error) {
+        response.error = "Couldn't write output-file.";
+    }
+    
+    long status = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &status);
+    
+    // A fresh entry, or one the server says is still current, stands in
+    // for the response; anything else new is offered to the cache.
+    struct http_cache_entry *entry = request->cache_entry;
+    if (entry != NULL && (request->served_from_cache || (request->result == CURLE_OK && status == 304))) {
+        if (!request->served_from_cache) {
+            http_cache_revalidated(entry, request->response_headers.data, request->response_headers.offset);
         }
-        state->data = realloc(state->data, new_length);
-        state->length = new_length;
+        status = entry->status;
+        free(request->response_headers.data);
+        request->response_headers = (struct write_state) {entry->headers_length, entry->headers_length + 1,
+                                                          entry->headers, NULL};
+        free(request->response_body.data);
+        request->response_body = (struct write_state) {entry->body_length, entry->body_length + 1,
+                                                       entry->body, NULL};
+        entry->headers = NULL;
+        entry->body = NULL;
+    } else if (request->cache_url != NULL && request->result == CURLE_OK && request->response_body.data != NULL) {
+        http_cache_store(request->cache_url, request->headers, status,
+                         request->response_headers.data, request->response_headers.offset,
+                         request->response_body.data, request->response_body.offset);
     }
+    response.status = status;
     
-    memcpy(state->data + state->offset, buffer, size * nmemb);
-    state->offset += size * nmemb;
-    state->data[state->offset] = '\0';
+    // How the body came: the protocol, the body bytes received, which
+    // are still compressed if it was, and the bytes once decoded. A
+    // response served from the cache received nothing.
+    long version = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_HTTP_VERSION, &version);
+    response.protocol = version == CURL_HTTP_VERSION_1_0 ? "HTTP/1.0"
+                        : version == CURL_HTTP_VERSION_1_1 ? "HTTP/1.1"
+                        : version == CURL_HTTP_VERSION_2_0 ? "HTTP/2"
+                        : version == CURL_HTTP_VERSION_3 ? "HTTP/3" : NULL;
+    curl_off_t wire_bytes = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_SIZE_DOWNLOAD_T, &wire_bytes);
+    response.wire_bytes = (double) wire_bytes;
+    response.body_bytes = (double) (request->streamed_bytes + request->response_body.offset);
     
-    return size * nmemb;
+    // The response takes the buffers over, and only makes JS values of
+    // them when they are read.
+    response.headers = request->response_headers.data;
+    response.headers_length = request->response_headers.offset;
+    response.body = request->response_body.data;
+    response.body_length = request->response_body.offset;
+    response.binary = request->binary_response;
+    request->response_headers.data = NULL;
+    request->response_body.data = NULL;
+    
+    return http_response_make(ctx, &response);
 }
 
 // Turn off optimization for this function. See https://github.com/mfikes/planck/issues/503
@@ -140,184 +626,154 @@ JSValueRef function_http_request(JSContextRef ctx, JSObjectRef function, JSObjec
                                  size_t argc, const JSValueRef args[], JSValueRef *exception) {
     if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeObject) {
         JSObjectRef opts = JSValueToObject(ctx, args[0], NULL);
-        JSValueRef url_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("url"), NULL);
-        char *url = value_to_c_string(ctx, url_ref);
-        JSValueRef timeout_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("timeout"), NULL);
-        time_t timeout = 0;
-        if (JSValueIsNumber(ctx, timeout_ref)) {
-            timeout = (time_t) JSValueToNumber(ctx, timeout_ref, NULL);
-        }
-        JSValueRef binary_response_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("binary-response"), NULL);
-        bool binary_response = false;
-        if (JSValueIsBoolean(ctx, binary_response_ref)) {
-            binary_response = JSValueToBoolean(ctx, binary_response_ref);
-        }
-        JSValueRef method_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("method"), NULL);
-        char *method = value_to_c_string(ctx, method_ref);
-        JSValueRef body_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("body"), NULL);
         
-        JSObjectRef headers_obj = JSValueToObject(ctx, JSObjectGetProperty(ctx, opts,
-                                                                           JSStringCreateWithUTF8CString("headers"),
-                                                                           NULL), NULL);
-        
-        CURL *handle = curl_easy_init();
-        assert(handle != NULL);
-        
-        curl_easy_setopt(handle, CURLOPT_CAINFO, ca_root_path); // set root CA certs
-        
-        curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, method);
-        curl_easy_setopt(handle, CURLOPT_URL, url);
-        
-        JSValueRef user_agent_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("user-agent"), NULL);
-        char *user_agent = NULL;
-        if (!JSValueIsUndefined(ctx, user_agent_ref)) {
-            user_agent = value_to_c_string(ctx, user_agent_ref);
-            curl_easy_setopt(handle, CURLOPT_USERAGENT, user_agent);
-        }
-        
-        JSValueRef follow_redirects_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("follow-redirects"), NULL);
-        if (JSValueIsBoolean(ctx, follow_redirects_ref)) {
-            if (JSValueToBoolean(ctx, follow_redirects_ref)) {
-                curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
-                
-                JSValueRef max_redirects_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("max-redirects"), NULL);
-                if (JSValueIsNumber(ctx, max_redirects_ref)) {
-                    long max_redirects = (long)JSValueToNumber(ctx, max_redirects_ref, NULL);
-                    curl_easy_setopt(handle, CURLOPT_MAXREDIRS, max_redirects);
-                }
-            }
+        const char *error = NULL;
+        struct http_request *request = http_request_create(ctx, opts, false, &error);
+        if (request == NULL) {
+            JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+            set_error(ctx, result, error);
+            return result;
         }
         
-        JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
-        JSValueProtect(ctx, result);
-        
-        JSValueRef insecure_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("insecure"), NULL);
-        bool insecure = false;
-        if(JSValueIsBoolean(ctx, insecure_ref)) {
-            insecure = JSValueToBoolean(ctx, insecure_ref);
+        if (!request->served_from_cache) {
+            request->result = curl_easy_perform(request->handle);
         }
+        flush_carry(request);
         
-        if(insecure) {
-            curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L);
-        }
+        JSObjectRef result = http_response_object(ctx, request);
+        http_request_free(request);
+        return result;
+    }
+    
+    return JSValueMakeNull(ctx);
+}
+
+static void deliver_response(void *data) {
+    struct http_request *request = data;
+    
+    // Every chunk was posted ahead of this, so the body is all in.
+    watchdog_begin();
+    flush_carry(request);
+    JSValueRef args[1];
+    args[0] = http_response_object(ctx, request);
+    JSObjectCallAsFunction(ctx, request->callback, NULL, 1, args, NULL);
+    watchdog_end();
+    
+    JSValueUnprotect(ctx, request->callback);
+    http_request_free(request);
+}
+
+// On the I/O thread.
+static void request_done(CURLcode result, void *data) {
+    struct http_request *request = data;
+    request->result = result;
+    js_thread_post(JS_TASK_IO, deliver_response, request);
+}
+
+struct request_error {
+    JSObjectRef callback;
+    const char *error;
+};
+
+static void deliver_error(void *data) {
+    struct request_error *request_error = data;
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_error(ctx, result, request_error->error);
+    JSValueRef args[1];
+    args[0] = result;
+    watchdog_begin();
+    JSObjectCallAsFunction(ctx, request_error->callback, NULL, 1, args, NULL);
+    watchdog_end();
+    
+    JSValueUnprotect(ctx, request_error->callback);
+    free(request_error);
+}
+
+// Like REPLETE_REQUEST, but returns an id for REPLETE_REQUEST_CANCEL
+// straight away and later calls callback with the response, on the JS
+// thread. If the request can't be made, this returns null and callback is
+// later called with the error, never before this returns.
+JSValueRef function_http_request_async(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                       size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 2 && JSValueGetType(ctx, args[0]) == kJSTypeObject && JSValueIsObject(ctx, args[1])) {
+        JSObjectRef opts = JSValueToObject(ctx, args[0], NULL);
+        JSObjectRef callback = JSValueToObject(ctx, args[1], NULL);
         
-        char *socket = NULL;
-        JSValueRef socket_ref = JSObjectGetProperty(ctx, opts, JSStringCreateWithUTF8CString("socket"), NULL);
-        if (!JSValueIsUndefined(ctx, socket_ref)) {
-            if (curl_has_feature(CURL_VERSION_UNIX_SOCKETS)) {
-                socket = value_to_c_string(ctx, socket_ref);
-                curl_easy_setopt(handle, CURLOPT_UNIX_SOCKET_PATH, socket);
-            } else {
-                JSStringRef error_str = JSStringCreateWithUTF8CString("This version of libcurl does not support UNIX sockets.");
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("error"), JSValueMakeString(ctx, error_str),
-                                    kJSPropertyAttributeReadOnly, NULL);
-                JSValueUnprotect(ctx, result);
-                return result;
+        const char *error = NULL;
+        struct http_request *request = http_request_create(ctx, opts, true, &error);
+        if (request != NULL) {
+            request->callback = callback;
+            JSValueProtect(ctx, callback);
+            // Served from the cache, there is nothing to cancel.
+            if (request->served_from_cache) {
+                js_thread_post(JS_TASK_IO, deliver_response, request);
+                return JSValueMakeNumber(ctx, 0);
             }
-        }
-        free(socket);
-        
-        struct curl_slist *headers = NULL;
-        if (!JSValueIsNull(ctx, headers_obj)) {
-            JSPropertyNameArrayRef properties = JSObjectCopyPropertyNames(ctx, headers_obj);
-            size_t n = JSPropertyNameArrayGetCount(properties);
-            int i;
-            for (i = 0; i < n; i++) {
-                JSStringRef key_str = JSPropertyNameArrayGetNameAtIndex(properties, i);
-                JSValueRef val_ref = JSObjectGetProperty(ctx, headers_obj, key_str, NULL);
-                
-                size_t len = JSStringGetLength(key_str) + 1;
-                char *key = malloc(len * sizeof(char));
-                JSStringGetUTF8CString(key_str, key, len);
-                JSStringRef val_as_str = to_string(ctx, val_ref);
-                char *val = value_to_c_string(ctx, JSValueMakeString(ctx, val_as_str));
-                JSStringRelease(val_as_str);
-                
-                size_t len_key = strlen(key);
-                size_t len_val = strlen(val);
-                char *header = malloc((len_key + len_val + 2 + 1) * sizeof(char));
-                sprintf(header, "%s: %s", key, val);
-                headers = curl_slist_append(headers, header);
-                free(header);
-                
-                free(key);
-                free(val);
+            unsigned long id = http_io_start(request->handle, request_done, request);
+            if (id) {
+                // Chunks are delivered on this thread, so none can need
+                // the id before it is set.
+                request->io_id = id;
+                return JSValueMakeNumber(ctx, (double) id);
             }
-            
-            curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
-        }
-        
-        curl_easy_setopt(handle, CURLOPT_TIMEOUT, timeout);
-        
-        char *body = NULL;
-        if (!JSValueIsUndefined(ctx, body_ref)) {
-            body = value_to_c_string(ctx, body_ref);
-            curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body);
-        }
-        
-        JSObjectRef response_headers = JSObjectMake(ctx, NULL, NULL);
-        struct header_state header_state;
-        header_state.headers = &response_headers;
-        curl_easy_setopt(handle, CURLOPT_HEADERDATA, &header_state);
-        curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_to_object_callback);
-        
-        struct write_state body_state;
-        body_state.offset = 0;
-        body_state.length = 0;
-        body_state.data = NULL;
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body_state);
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_string_callback);
-        
-        int res = curl_easy_perform(handle);
-        if (res != 0) {
-            JSStringRef error_str = JSStringCreateWithUTF8CString(curl_easy_strerror(res));
-            JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("error"), JSValueMakeString(ctx, error_str),
-                                kJSPropertyAttributeReadOnly, NULL);
+            http_request_free(request);
+            error = "Couldn't start the request.";
+        } else {
+            JSValueProtect(ctx, callback);
         }
         
-        int status = 0;
-        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
-        
-        free(body);
-        free(user_agent);
-        
-        // printf("%d bytes, %x\n", body_state.offset, body_state.data);
-        if (body_state.data != NULL) {
-            if (binary_response) {
-                JSValueRef* bytes = malloc(sizeof(JSValueRef)*body_state.offset);
-                int i;
-                for (i = 0; i < body_state.offset; i++) {
-                    bytes[i] = JSValueMakeNumber(ctx, (uint8_t )body_state.data[i]);
-                }
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("body"),
-                                    JSObjectMakeArray(ctx, body_state.offset, bytes, NULL),
-                                    kJSPropertyAttributeReadOnly, NULL);
-                free(bytes);
-            } else {
-                JSStringRef body_str = JSStringCreateWithUTF8CString(body_state.data);
-                JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("body"),
-                                    JSValueMakeString(ctx, body_str),
-                                    kJSPropertyAttributeReadOnly, NULL);
-            }
-            free(body_state.data);
+        struct request_error *request_error = malloc(sizeof(struct request_error));
+        if (request_error != NULL) {
+            request_error->callback = callback;
+            request_error->error = error;
+            js_thread_post(JS_TASK_IO, deliver_error, request_error);
+        } else {
+            JSValueUnprotect(ctx, callback);
         }
-        
-        JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("status"), JSValueMakeNumber(ctx, status),
-                            kJSPropertyAttributeReadOnly, NULL);
-        JSObjectSetProperty(ctx, result, JSStringCreateWithUTF8CString("headers"), response_headers,
-                            kJSPropertyAttributeReadOnly, NULL);
-        
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(handle);
-        
-        JSValueUnprotect(ctx, result);
-        return result;
     }
     
     return JSValueMakeNull(ctx);
 }
 
+JSValueRef function_http_request_cancel(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                        size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    if (argc == 1 && JSValueGetType(ctx, args[0]) == kJSTypeNumber) {
+        return JSValueMakeBoolean(ctx, http_io_cancel((unsigned long) JSValueToNumber(ctx, args[0], NULL)));
+    }
+    return JSValueMakeBoolean(ctx, false);
+}
+
+static void set_stat(JSContextRef ctx, JSObjectRef obj, const char *name, double value) {
+    JSStringRef name_str = JSStringCreateWithUTF8CString(name);
+    JSObjectSetProperty(ctx, obj, name_str, JSValueMakeNumber(ctx, value), kJSPropertyAttributeReadOnly, NULL);
+    JSStringRelease(name_str);
+}
+
+JSValueRef function_http_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception) {
+    struct http_pool_stats stats;
+    http_pool_get_stats(&stats);
+    
+    JSObjectRef result = JSObjectMake(ctx, NULL, NULL);
+    set_stat(ctx, result, "requests", (double) stats.requests);
+    set_stat(ctx, result, "new-connections", (double) stats.new_connections);
+    set_stat(ctx, result, "reused-connections", (double) stats.reused_connections);
+    set_stat(ctx, result, "handles-created", (double) stats.handles_created);
+    set_stat(ctx, result, "idle-handles", (double) stats.idle_handles);
+    
+    struct http_cache_stats cache_stats;
+    http_cache_get_stats(&cache_stats);
+    set_stat(ctx, result, "cache-hits", (double) cache_stats.hits);
+    set_stat(ctx, result, "cache-misses", (double) cache_stats.misses);
+    set_stat(ctx, result, "cache-revalidations", (double) cache_stats.revalidations);
+    set_stat(ctx, result, "cache-not-modified", (double) cache_stats.not_modified);
+    set_stat(ctx, result, "cache-evictions", (double) cache_stats.evictions);
+    set_stat(ctx, result, "cache-entries", (double) cache_stats.entries);
+    set_stat(ctx, result, "cache-bytes", (double) cache_stats.bytes);
+    return result;
+}
+
 #ifdef HTTP_TEST
 int main(int argc, char **argv) {
     CURL *curl = curl_easy_init();
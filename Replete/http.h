@@ -4,3 +4,12 @@ void set_ca_root_path(const char* path);
 
 JSValueRef function_http_request(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
                                  size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_http_request_async(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                       size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_http_request_cancel(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                                        size_t argc, const JSValueRef args[], JSValueRef *exception);
+
+JSValueRef function_http_stats(JSContextRef ctx, JSObjectRef function, JSObjectRef this_object,
+                               size_t argc, const JSValueRef args[], JSValueRef *exception);
@@ -0,0 +1,798 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "http_cache.h"
+
+// Each entry is one file, named for a hash of its URL, holding:
+//
+//   RCACHE1\n
+//   <url>\n
+//   <expires, seconds since the epoch; 0 if it must be revalidated>\n
+//   <status>\n
+//   <number of Vary headers>\n
+//   <name>\n<request's value>\n  (for each Vary header)
+//   <length>\n<raw response headers>
+//   <length>\n<body>
+//
+// An in-memory index of each entry's size and last use, rebuilt from the
+// directory on open, decides what to evict. Last use survives restarts as
+// the file's modification time.
+
+#define HTTP_CACHE_MAGIC "RCACHE1"
+#define HTTP_CACHE_MAX_VARY 8
+#define HTTP_CACHE_MAX_HEURISTIC_SECONDS (24 * 60 * 60)
+#define HTTP_CACHE_MAX_HEADER 1024
+
+struct index_entry {
+    unsigned long long key;
+    size_t size;
+    uint64_t last_used;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+static size_t cache_max_bytes = 0;
+
+static struct index_entry *index_entries = NULL;
+static size_t index_count = 0;
+static size_t index_capacity = 0;
+static size_t total_bytes = 0;
+
+static struct http_cache_stats stats;
+
+static uint64_t now_nanos(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static unsigned long long hash_url(const char *url) {
+    unsigned long long hash = 14695981039346656037ULL;
+    const char *method = "GET ";
+    const char *s;
+    for (s = method; *s; s++) {
+        hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+    }
+    for (s = url; *s; s++) {
+        hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void entry_path(unsigned long long key, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx", cache_dir, key);
+}
+
+static struct index_entry *index_find(unsigned long long key) {
+    size_t i;
+    for (i = 0; i < index_count; i++) {
+        if (index_entries[i].key == key) {
+            return &index_entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void index_remove(struct index_entry *entry) {
+    total_bytes -= entry->size;
+    *entry = index_entries[--index_count];
+}
+
+static void index_put(unsigned long long key, size_t size, uint64_t last_used) {
+    struct index_entry *entry = index_find(key);
+    if (entry == NULL) {
+        if (index_count == index_capacity) {
+            size_t capacity = index_capacity ? index_capacity * 2 : 64;
+            struct index_entry *grown = realloc(index_entries, capacity * sizeof(struct index_entry));
+            if (grown == NULL) {
+                return;
+            }
+            index_entries = grown;
+            index_capacity = capacity;
+        }
+        entry = &index_entries[index_count++];
+        entry->key = key;
+        entry->size = 0;
+    }
+    total_bytes = total_bytes - entry->size + size;
+    entry->size = size;
+    entry->last_used = last_used;
+}
+
+static void evict_until_within(size_t max_bytes, unsigned long long keep) {
+    while (total_bytes > max_bytes && index_count > 0) {
+        struct index_entry *oldest = NULL;
+        size_t i;
+        for (i = 0; i < index_count; i++) {
+            if (index_entries[i].key != keep
+                && (oldest == NULL || index_entries[i].last_used < oldest->last_used)) {
+                oldest = &index_entries[i];
+            }
+        }
+        if (oldest == NULL) {
+            return;
+        }
+        char path[FILENAME_MAX];
+        entry_path(oldest->key, path, sizeof(path));
+        unlink(path);
+        index_remove(oldest);
+        stats.evictions++;
+    }
+}
+
+bool http_cache_open(const char *dir, size_t max_bytes) {
+    pthread_mutex_lock(&cache_lock);
+    free(cache_dir);
+    cache_dir = NULL;
+    index_count = 0;
+    total_bytes = 0;
+
+    // Entry paths are dir plus a 16 digit key, and must fit in FILENAME_MAX.
+    if (strlen(dir) + 18 > FILENAME_MAX) {
+        pthread_mutex_unlock(&cache_lock);
+        return false;
+    }
+    mkdir(dir, 0755);
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        pthread_mutex_unlock(&cache_lock);
+        return false;
+    }
+    cache_dir = strdup(dir);
+    cache_max_bytes = max_bytes;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strlen(ent->d_name) != 16 || strspn(ent->d_name, "0123456789abcdef") != 16) {
+            continue;
+        }
+        char path[FILENAME_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            index_put(strtoull(ent->d_name, NULL, 16), st.st_size,
+                      (uint64_t) st.st_mtime * 1000000000);
+        }
+    }
+    closedir(d);
+
+    evict_until_within(cache_max_bytes, 0);
+    pthread_mutex_unlock(&cache_lock);
+    return true;
+}
+
+// The value of the last name header in the last header block of headers
+// (the final response, after any redirects), trimmed.
+static bool find_header(const char *headers, size_t length, const char *name, char *value, size_t value_size) {
+    size_t name_length = strlen(name);
+    bool found = false;
+    size_t line_start = 0;
+    while (line_start < length) {
+        const char *line = headers + line_start;
+        const char *newline = memchr(line, '\n', length - line_start);
+        size_t line_length = newline ? (size_t) (newline - line) : length - line_start;
+        line_start += line_length + 1;
+
+        if (line_length >= 5 && strncmp(line, "HTTP/", 5) == 0) {
+            found = false;
+            continue;
+        }
+        if (line_length <= name_length || line[name_length] != ':'
+            || strncasecmp(line, name, name_length) != 0) {
+            continue;
+        }
+        const char *start = line + name_length + 1;
+        const char *end = line + line_length;
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        while (end > start && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        size_t n = end - start;
+        if (n >= value_size) {
+            n = value_size - 1;
+        }
+        memcpy(value, start, n);
+        value[n] = '\0';
+        found = true;
+    }
+    return found;
+}
+
+// The value of a request header set in curl's "Name: value" form.
+static const char *request_header(const struct curl_slist *headers, const char *name) {
+    size_t name_length = strlen(name);
+    const struct curl_slist *h;
+    for (h = headers; h != NULL; h = h->next) {
+        if (strncasecmp(h->data, name, name_length) == 0 && h->data[name_length] == ':') {
+            const char *value = h->data + name_length + 1;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            return value;
+        }
+    }
+    return "";
+}
+
+// Whether a comma-separated directive list contains token, and its
+// "=value" if it has one.
+static bool has_directive(const char *list, const char *token, long *value) {
+    size_t token_length = strlen(token);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+        if (strncasecmp(p, token, token_length) == 0
+            && (p[token_length] == '\0' || p[token_length] == ',' || p[token_length] == '='
+                || p[token_length] == ' ')) {
+            if (value != NULL && p[token_length] == '=') {
+                *value = strtol(p + token_length + 1 + (p[token_length + 1] == '"'), NULL, 10);
+            }
+            return true;
+        }
+        while (*p && *p != ',') {
+            p++;
+        }
+    }
+    return false;
+}
+
+// How long a response may be served without asking the server: 0 if it
+// must be revalidated every time, -1 if it mustn't be stored at all.
+static time_t freshness_deadline(const char *headers, size_t length, time_t now) {
+    char value[HTTP_CACHE_MAX_HEADER];
+    if (find_header(headers, length, "Cache-Control", value, sizeof(value))) {
+        long max_age = 0;
+        if (has_directive(value, "no-store", NULL)) {
+            return -1;
+        }
+        if (has_directive(value, "no-cache", NULL)) {
+            return 0;
+        }
+        if (has_directive(value, "max-age", &max_age)) {
+            return max_age > 0 ? now + max_age : 0;
+        }
+    }
+    if (find_header(headers, length, "Expires", value, sizeof(value))) {
+        time_t expires = curl_getdate(value, NULL);
+        return expires > now ? expires : 0;
+    }
+    // Nothing said; like browsers, trust a resource for a tenth of the
+    // time since it last changed.
+    if (find_header(headers, length, "Last-Modified", value, sizeof(value))) {
+        time_t modified = curl_getdate(value, NULL);
+        if (modified > 0 && modified < now) {
+            time_t heuristic = (now - modified) / 10;
+            if (heuristic > HTTP_CACHE_MAX_HEURISTIC_SECONDS) {
+                heuristic = HTTP_CACHE_MAX_HEURISTIC_SECONDS;
+            }
+            return heuristic > 0 ? now + heuristic : 0;
+        }
+    }
+    return 0;
+}
+
+static bool write_entry(const char *url, const struct curl_slist *request_headers, long status, time_t expires,
+                        const char *headers, size_t headers_length, const char *body, size_t body_length,
+                        unsigned long long key, size_t *size) {
+    char vary[HTTP_CACHE_MAX_HEADER];
+    char *names[HTTP_CACHE_MAX_VARY];
+    int vary_count = 0;
+    if (find_header(headers, headers_length, "Vary", vary, sizeof(vary))) {
+        char *save = NULL;
+        char *name = strtok_r(vary, ", ", &save);
+        while (name != NULL) {
+            if (strcmp(name, "*") == 0 || vary_count == HTTP_CACHE_MAX_VARY) {
+                return false;
+            }
+            names[vary_count++] = name;
+            name = strtok_r(NULL, ", ", &save);
+        }
+    }
+
+    char path[FILENAME_MAX];
+    char temp_path[FILENAME_MAX + sizeof(".tmp")];
+    entry_path(key, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *f = fopen(temp_path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    // The expiry is zero-padded so http_cache_revalidated can rewrite it
+    // in place.
+    fprintf(f, "%s\n%s\n%020lld\n%ld\n%d\n", HTTP_CACHE_MAGIC, url, (long long) expires, status, vary_count);
+    int i;
+    for (i = 0; i < vary_count; i++) {
+        fprintf(f, "%s\n%s\n", names[i], request_header(request_headers, names[i]));
+    }
+    fprintf(f, "%zu\n", headers_length);
+    fwrite(headers, 1, headers_length, f);
+    fprintf(f, "%zu\n", body_length);
+    fwrite(body, 1, body_length, f);
+    *size = ftell(f);
+    if (ferror(f) | fclose(f)) {
+        unlink(temp_path);
+        return false;
+    }
+    return rename(temp_path, path) == 0;
+}
+
+static bool read_line(FILE *f, char *line, size_t size) {
+    if (fgets(line, (int) size, f) == NULL) {
+        return false;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    return true;
+}
+
+static char *read_block(FILE *f, size_t *length) {
+    char line[32];
+    if (!read_line(f, line, sizeof(line))) {
+        return NULL;
+    }
+    *length = strtoull(line, NULL, 10);
+    char *block = malloc(*length + 1);
+    if (block == NULL || fread(block, 1, *length, f) != *length) {
+        free(block);
+        return NULL;
+    }
+    block[*length] = '\0';
+    return block;
+}
+
+static struct http_cache_entry *read_entry(unsigned long long key, const char *url,
+                                           const struct curl_slist *request_headers) {
+    char path[FILENAME_MAX];
+    entry_path(key, path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    struct http_cache_entry *entry = calloc(1, sizeof(struct http_cache_entry));
+    size_t url_size = strlen(url) + 2;
+    char *line = malloc(url_size > HTTP_CACHE_MAX_HEADER ? url_size : HTTP_CACHE_MAX_HEADER);
+    size_t line_size = url_size > HTTP_CACHE_MAX_HEADER ? url_size : HTTP_CACHE_MAX_HEADER;
+    bool ok = read_line(f, line, line_size) && strcmp(line, HTTP_CACHE_MAGIC) == 0
+              && read_line(f, line, line_size) && strcmp(line, url) == 0;
+    if (ok && (ok = read_line(f, line, line_size))) {
+        entry->expires = (time_t) strtoll(line, NULL, 10);
+    }
+    if (ok && (ok = read_line(f, line, line_size))) {
+        entry->status = strtol(line, NULL, 10);
+    }
+    int vary_count = 0;
+    if (ok && (ok = read_line(f, line, line_size))) {
+        vary_count = atoi(line);
+    }
+    // A response that varied on headers this request has differently
+    // doesn't count.
+    int i;
+    for (i = 0; ok && i < vary_count; i++) {
+        char name[HTTP_CACHE_MAX_HEADER];
+        ok = read_line(f, name, sizeof(name)) && read_line(f, line, line_size)
+             && strcmp(line, request_header(request_headers, name)) == 0;
+    }
+    if (ok) {
+        entry->headers = read_block(f, &entry->headers_length);
+        entry->body = read_block(f, &entry->body_length);
+        ok = entry->headers != NULL && entry->body != NULL;
+    }
+    free(line);
+    fclose(f);
+
+    if (!ok) {
+        http_cache_entry_free(entry);
+        return NULL;
+    }
+    entry->key = key;
+    return entry;
+}
+
+struct http_cache_entry *http_cache_lookup(const char *url, const struct curl_slist *request_headers) {
+    pthread_mutex_lock(&cache_lock);
+    if (cache_dir == NULL) {
+        pthread_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+    unsigned long long key = hash_url(url);
+    struct http_cache_entry *entry = NULL;
+    struct index_entry *indexed = index_find(key);
+    if (indexed != NULL) {
+        entry = read_entry(key, url, request_headers);
+    }
+    if (entry == NULL) {
+        stats.misses++;
+    } else {
+        indexed->last_used = now_nanos();
+        char path[FILENAME_MAX];
+        entry_path(key, path, sizeof(path));
+        utimes(path, NULL);
+        if (http_cache_is_fresh(entry)) {
+            stats.hits++;
+        } else {
+            stats.revalidations++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+bool http_cache_is_fresh(const struct http_cache_entry *entry) {
+    return entry->expires > time(NULL);
+}
+
+struct curl_slist *http_cache_add_validators(const struct http_cache_entry *entry, struct curl_slist *request_headers) {
+    char value[HTTP_CACHE_MAX_HEADER];
+    char header[HTTP_CACHE_MAX_HEADER + 32];
+    bool added = false;
+    if (find_header(entry->headers, entry->headers_length, "ETag", value, sizeof(value))) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", value);
+        request_headers = curl_slist_append(request_headers, header);
+        added = true;
+    }
+    if (find_header(entry->headers, entry->headers_length, "Last-Modified", value, sizeof(value))) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", value);
+        request_headers = curl_slist_append(request_headers, header);
+        added = true;
+    }
+    return added ? request_headers : NULL;
+}
+
+// Rewrites the entry in place with its new expiry.
+void http_cache_revalidated(struct http_cache_entry *entry, const char *headers, size_t headers_length) {
+    pthread_mutex_lock(&cache_lock);
+    stats.not_modified++;
+    time_t expires = freshness_deadline(headers, headers_length, time(NULL));
+    entry->expires = expires > 0 ? expires : 0;
+    if (cache_dir != NULL) {
+        char path[FILENAME_MAX];
+        entry_path(entry->key, path, sizeof(path));
+        FILE *f = fopen(path, "r+b");
+        if (f != NULL) {
+            char line[HTTP_CACHE_MAX_HEADER];
+            // Past the magic and the URL to the expiry, which is written at
+            // a fixed width so nothing after it moves.
+            if (fgets(line, sizeof(line), f) != NULL) {
+                int c;
+                while ((c = fgetc(f)) != EOF && c != '\n') {
+                }
+                long offset = ftell(f);
+                if (fgets(line, sizeof(line), f) != NULL && fseek(f, offset, SEEK_SET) == 0) {
+                    size_t width = strcspn(line, "\n");
+                    fprintf(f, "%0*lld", (int) width, (long long) entry->expires);
+                }
+            }
+            fclose(f);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void http_cache_store(const char *url, const struct curl_slist *request_headers, long status,
+                      const char *headers, size_t headers_length, const char *body, size_t body_length) {
+    if (status != 200) {
+        return;
+    }
+    time_t expires = freshness_deadline(headers, headers_length, time(NULL));
+    if (expires < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_dir == NULL || headers_length + body_length > cache_max_bytes) {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    unsigned long long key = hash_url(url);
+    size_t size = 0;
+    if (write_entry(url, request_headers, status, expires, headers, headers_length, body, body_length, key, &size)) {
+        index_put(key, size, now_nanos());
+        stats.stores++;
+        evict_until_within(cache_max_bytes, key);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void http_cache_entry_free(struct http_cache_entry *entry) {
+    if (entry != NULL) {
+        free(entry->headers);
+        free(entry->body);
+        free(entry);
+    }
+}
+
+void http_cache_get_stats(struct http_cache_stats *out) {
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    out->entries = index_count;
+    out->bytes = total_bytes;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+#ifdef HTTP_CACHE_TEST
+// cc -DHTTP_CACHE_TEST http_cache.c -lcurl -lpthread
+//
+// Runs requests through the cache the way http.c does, against a
+// loopback server standing in for the network.
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static int server_requests = 0;
+static int server_not_modified = 0;
+
+// Answers by path:
+//   /fresh     cacheable for a minute
+//   /etag      no-cache, with an ETag it answers If-None-Match for
+//   /dated     Last-Modified an hour ago, answers If-Modified-Since
+//   /vary      varies on Accept, echoing it
+//   /no-store  never cached
+//   /big/N     200 bytes, cacheable
+static void respond(int fd, const char *request) {
+    char path[256] = "";
+    sscanf(request, "GET %255s", path);
+    server_requests++;
+
+    const char *last_modified = "Thu, 01 Jan 2015 00:00:00 GMT";
+    char headers[512] = "";
+    char body[256] = "";
+    int status = 200;
+
+    if (strcmp(path, "/fresh") == 0) {
+        strcpy(headers, "Cache-Control: max-age=60\r\n");
+        strcpy(body, "fresh body");
+    } else if (strcmp(path, "/etag") == 0) {
+        if (strstr(request, "If-None-Match: \"v1\"") != NULL) {
+            status = 304;
+        }
+        strcpy(headers, "Cache-Control: no-cache\r\nETag: \"v1\"\r\n");
+        strcpy(body, "etag body");
+    } else if (strcmp(path, "/dated") == 0) {
+        if (strstr(request, "If-Modified-Since: ") != NULL) {
+            status = 304;
+        }
+        snprintf(headers, sizeof(headers), "Cache-Control: max-age=0\r\nLast-Modified: %s\r\n", last_modified);
+        strcpy(body, "dated body");
+    } else if (strcmp(path, "/vary") == 0) {
+        const char *accept = strstr(request, "Accept: ");
+        strcpy(headers, "Cache-Control: max-age=60\r\nVary: Accept\r\n");
+        if (accept != NULL) {
+            sscanf(accept, "Accept: %100[^\r]", body);
+        }
+    } else if (strcmp(path, "/no-store") == 0) {
+        strcpy(headers, "Cache-Control: no-store\r\n");
+        strcpy(body, "secret");
+    } else if (strncmp(path, "/big/", 5) == 0) {
+        strcpy(headers, "Cache-Control: max-age=60\r\n");
+        memset(body, 'x', 200);
+        body[200] = '\0';
+    } else {
+        status = 404;
+    }
+
+    if (status == 304) {
+        server_not_modified++;
+        body[0] = '\0';
+    }
+    char response[1024];
+    int n = snprintf(response, sizeof(response),
+                     "HTTP/1.1 %d %s\r\n%sContent-Length: %zu\r\nConnection: close\r\n\r\n%s",
+                     status, status == 304 ? "Not Modified" : "OK", headers, strlen(body), body);
+    write(fd, response, n);
+}
+
+static void *serve(void *arg) {
+    int listener = *(int *) arg;
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        char request[4096];
+        size_t length = 0;
+        ssize_t n;
+        while (length < sizeof(request) - 1 && (n = read(fd, request + length, sizeof(request) - 1 - length)) > 0) {
+            length += n;
+            request[length] = '\0';
+            if (strstr(request, "\r\n\r\n") != NULL) {
+                break;
+            }
+        }
+        request[length] = '\0';
+        respond(fd, request);
+        close(fd);
+    }
+    return NULL;
+}
+
+struct buffer {
+    char *data;
+    size_t length;
+};
+
+static size_t collect(char *data, size_t size, size_t nmemb, void *userdata) {
+    struct buffer *buffer = userdata;
+    buffer->data = realloc(buffer->data, buffer->length + size * nmemb + 1);
+    memcpy(buffer->data + buffer->length, data, size * nmemb);
+    buffer->length += size * nmemb;
+    buffer->data[buffer->length] = '\0';
+    return size * nmemb;
+}
+
+static int port;
+
+// Returns the body, from the cache or the server.
+static char *fetch(const char *path, const char *accept) {
+    char url[256];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", port, path);
+    struct curl_slist *headers = NULL;
+    if (accept != NULL) {
+        char header[128];
+        snprintf(header, sizeof(header), "Accept: %s", accept);
+        headers = curl_slist_append(headers, header);
+    }
+
+    struct http_cache_entry *entry = http_cache_lookup(url, headers);
+    if (entry != NULL && http_cache_is_fresh(entry)) {
+        char *body = strdup(entry->body);
+        http_cache_entry_free(entry);
+        curl_slist_free_all(headers);
+        return body;
+    }
+    struct curl_slist *with_validators = NULL;
+    if (entry != NULL) {
+        with_validators = http_cache_add_validators(entry, headers);
+        if (with_validators != NULL) {
+            headers = with_validators;
+        }
+    }
+
+    CURL *handle = curl_easy_init();
+    struct buffer response_headers = {NULL, 0};
+    struct buffer body = {strdup(""), 0};
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, collect);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &response_headers);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, collect);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body);
+    assert(curl_easy_perform(handle) == CURLE_OK);
+    long status = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_cleanup(handle);
+
+    if (status == 304 && entry != NULL) {
+        http_cache_revalidated(entry, response_headers.data, response_headers.length);
+        free(body.data);
+        body.data = strdup(entry->body);
+    } else {
+        http_cache_store(url, headers, status, response_headers.data, response_headers.length,
+                         body.data, body.length);
+    }
+    http_cache_entry_free(entry);
+    free(response_headers.data);
+    curl_slist_free_all(headers);
+    return body.data;
+}
+
+static void expect_body(const char *path, const char *accept, const char *expected) {
+    char *body = fetch(path, accept);
+    if (strcmp(body, expected) != 0) {
+        fprintf(stderr, "%s: expected \"%s\", got \"%s\"\n", path, expected, body);
+        exit(1);
+    }
+    free(body);
+}
+
+static void expect(const char *what, long actual, long expected) {
+    if (actual != expected) {
+        fprintf(stderr, "%s: expected %ld, got %ld\n", what, expected, actual);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_length = sizeof(addr);
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 16) != 0
+        || getsockname(listener, (struct sockaddr *) &addr, &addr_length) != 0) {
+        perror("listen");
+        return 1;
+    }
+    port = ntohs(addr.sin_port);
+    pthread_t server;
+    pthread_create(&server, NULL, serve, &listener);
+
+    char dir[] = "/tmp/http-cache-test-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    assert(http_cache_open(dir, 1024 * 1024));
+
+    // Fresh: the second fetch never reaches the server.
+    expect_body("/fresh", NULL, "fresh body");
+    expect_body("/fresh", NULL, "fresh body");
+    expect("fresh requests", server_requests, 1);
+
+    // ETag: every fetch asks, and a 304 is answered from disk.
+    expect_body("/etag", NULL, "etag body");
+    expect_body("/etag", NULL, "etag body");
+    expect_body("/etag", NULL, "etag body");
+    expect("etag requests", server_requests, 4);
+    expect("etag 304s", server_not_modified, 2);
+
+    // Last-Modified alone works the same way.
+    expect_body("/dated", NULL, "dated body");
+    expect_body("/dated", NULL, "dated body");
+    expect("dated 304s", server_not_modified, 3);
+
+    // Vary: a different Accept is a different response.
+    expect_body("/vary", "text/plain", "text/plain");
+    expect_body("/vary", "text/plain", "text/plain");
+    expect("vary requests", server_requests, 7);
+    expect_body("/vary", "application/json", "application/json");
+    expect("vary requests", server_requests, 8);
+
+    // no-store: never kept.
+    expect_body("/no-store", NULL, "secret");
+    expect_body("/no-store", NULL, "secret");
+    expect("no-store requests", server_requests, 10);
+
+    struct http_cache_stats stats;
+    http_cache_get_stats(&stats);
+    expect("hits", stats.hits, 2);
+    expect("revalidations", stats.revalidations, 3);
+    expect("not modified", stats.not_modified, 3);
+
+    // Reopened, as after a restart, the cache still has everything.
+    assert(http_cache_open(dir, 1024 * 1024));
+    int before = server_requests;
+    expect_body("/fresh", NULL, "fresh body");
+    expect("requests after reopen", server_requests, before);
+
+    // Bounded: with room for about three 200-byte entries, the least
+    // recently used go first.
+    assert(http_cache_open(dir, 3 * 400));
+    http_cache_get_stats(&stats);
+    unsigned long evicted = stats.evictions;
+    assert(stats.bytes <= 3 * 400);
+    int i;
+    char path[32];
+    for (i = 1; i <= 5; i++) {
+        snprintf(path, sizeof(path), "/big/%d", i);
+        free(fetch(path, NULL));
+    }
+    http_cache_get_stats(&stats);
+    assert(stats.bytes <= 3 * 400);
+    assert(stats.evictions > evicted);
+    before = server_requests;
+    free(fetch("/big/5", NULL));
+    expect("most recent kept", server_requests, before);
+    free(fetch("/big/1", NULL));
+    expect("least recent evicted", server_requests, before + 1);
+
+    printf("http cache tests passed: %lu hits, %lu misses, %lu revalidations, %lu evictions\n",
+           stats.hits, stats.misses, stats.revalidations, stats.evictions);
+    return 0;
+}
+#endif
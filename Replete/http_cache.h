@@ -0,0 +1,61 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+// An on-disk cache of GET responses for REPLETE_REQUEST, for requests
+// that opt in. Entries are kept fresh as Cache-Control and Expires say,
+// then revalidated with If-None-Match / If-Modified-Since; the least
+// recently used are evicted to stay within a size bound.
+
+// Caches under dir, which is created if need be, in at most max_bytes.
+// Can be called again to switch directories. Returns false if dir can't
+// be used, leaving the cache off.
+bool http_cache_open(const char *dir, size_t max_bytes);
+
+struct http_cache_entry {
+    unsigned long long key;
+    long status;
+    char *headers;
+    size_t headers_length;
+    char *body;
+    size_t body_length;
+    time_t expires;
+};
+
+// The entry for a GET of url, if there is one whose Vary headers match
+// request_headers. Free with http_cache_entry_free.
+struct http_cache_entry *http_cache_lookup(const char *url, const struct curl_slist *request_headers);
+
+bool http_cache_is_fresh(const struct http_cache_entry *entry);
+
+// Adds the headers that ask the server whether entry is still current.
+// Returns NULL, adding nothing, if entry can't be revalidated.
+struct curl_slist *http_cache_add_validators(const struct http_cache_entry *entry, struct curl_slist *request_headers);
+
+// The server said entry is still current (304) with these headers, which
+// set how long it is fresh for now.
+void http_cache_revalidated(struct http_cache_entry *entry, const char *headers, size_t headers_length);
+
+// Caches a GET response, unless its headers say not to. headers is the
+// raw header block, status line included.
+void http_cache_store(const char *url, const struct curl_slist *request_headers, long status,
+                      const char *headers, size_t headers_length, const char *body, size_t body_length);
+
+void http_cache_entry_free(struct http_cache_entry *entry);
+
+struct http_cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    // Stale entries checked with the server, and how many were still
+    // current.
+    unsigned long revalidations;
+    unsigned long not_modified;
+    unsigned long stores;
+    unsigned long evictions;
+    size_t entries;
+    size_t bytes;
+};
+
+void http_cache_get_stats(struct http_cache_stats *stats);
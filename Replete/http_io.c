@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "http_io.h"
+
+// New transfers, cancellations and resumptions are queued under io_lock and picked up
+// by the I/O thread, which is woken from curl_multi_poll to take them; only
+// that thread touches the multi handle.
+//
+// The per-host limit is curl's own CURLMOPT_MAX_HOST_CONNECTIONS, which
+// holds transfers back until a connection to their host is free. Over
+// HTTP/2 one connection can carry several transfers at once.
+
+#define HTTP_IO_MAX_HOST_CONNECTIONS 6
+#define HTTP_IO_MAX_TOTAL_CONNECTIONS 24
+#define HTTP_IO_POLL_MILLIS 1000
+
+struct transfer {
+    unsigned long id;
+    CURL *handle;
+    http_io_done_t done;
+    void *data;
+    bool added;
+    bool cancelled;
+    bool resume;
+    struct transfer *next;
+};
+
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool thread_started = false;
+static CURLM *multi = NULL;
+
+static struct transfer *transfers = NULL;
+static unsigned long next_id = 1;
+
+static void unlink_transfer(struct transfer *transfer) {
+    struct transfer **p = &transfers;
+    while (*p != transfer) {
+        p = &(*p)->next;
+    }
+    *p = transfer->next;
+}
+
+static void finish(struct transfer *transfer, CURLcode result) {
+    transfer->done(result, transfer->data);
+    free(transfer);
+}
+
+static void *io_thread(void *arg) {
+    for (;;) {
+        // Adds new transfers and takes out cancelled ones.
+        struct transfer *cancelled = NULL;
+        pthread_mutex_lock(&io_lock);
+        struct transfer **p = &transfers;
+        while (*p != NULL) {
+            struct transfer *transfer = *p;
+            if (transfer->cancelled) {
+                if (transfer->added) {
+                    curl_multi_remove_handle(multi, transfer->handle);
+                }
+                *p = transfer->next;
+                transfer->next = cancelled;
+                cancelled = transfer;
+                continue;
+            }
+            if (!transfer->added) {
+                curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+                curl_multi_add_handle(multi, transfer->handle);
+                transfer->added = true;
+            }
+            if (transfer->resume) {
+                curl_easy_pause(transfer->handle, CURLPAUSE_CONT);
+                transfer->resume = false;
+            }
+            p = &transfer->next;
+        }
+        pthread_mutex_unlock(&io_lock);
+
+        while (cancelled != NULL) {
+            struct transfer *transfer = cancelled;
+            cancelled = transfer->next;
+            finish(transfer, CURLE_ABORTED_BY_CALLBACK);
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            struct transfer *transfer = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &transfer);
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(multi, msg->easy_handle);
+
+            pthread_mutex_lock(&io_lock);
+            unlink_transfer(transfer);
+            pthread_mutex_unlock(&io_lock);
+
+            finish(transfer, result);
+        }
+
+        curl_multi_poll(multi, NULL, 0, HTTP_IO_POLL_MILLIS, NULL);
+    }
+    return NULL;
+}
+
+static bool start_thread(void) {
+    multi = curl_multi_init();
+    if (multi == NULL) {
+        return false;
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long) HTTP_IO_MAX_HOST_CONNECTIONS);
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) HTTP_IO_MAX_TOTAL_CONNECTIONS);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &attr, io_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        curl_multi_cleanup(multi);
+        multi = NULL;
+        return false;
+    }
+    thread_started = true;
+    return true;
+}
+
+unsigned long http_io_start(CURL *handle, http_io_done_t done, void *data) {
+    struct transfer *transfer = malloc(sizeof(struct transfer));
+    if (transfer == NULL) {
+        return 0;
+    }
+    transfer->handle = handle;
+    transfer->done = done;
+    transfer->data = data;
+    transfer->added = false;
+    transfer->cancelled = false;
+    transfer->resume = false;
+
+    pthread_mutex_lock(&io_lock);
+    if (!thread_started && !start_thread()) {
+        pthread_mutex_unlock(&io_lock);
+        free(transfer);
+        return 0;
+    }
+    transfer->id = next_id++;
+    transfer->next = NULL;
+    struct transfer **p = &transfers;
+    while (*p != NULL) {
+        p = &(*p)->next;
+    }
+    *p = transfer;
+    unsigned long id = transfer->id;
+    curl_multi_wakeup(multi);
+    pthread_mutex_unlock(&io_lock);
+    return id;
+}
+
+bool http_io_cancel(unsigned long id) {
+    bool found = false;
+    pthread_mutex_lock(&io_lock);
+    struct transfer *transfer;
+    for (transfer = transfers; transfer != NULL; transfer = transfer->next) {
+        if (transfer->id == id && !transfer->cancelled) {
+            transfer->cancelled = true;
+            found = true;
+            curl_multi_wakeup(multi);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&io_lock);
+    return found;
+}
+
+void http_io_resume(unsigned long id) {
+    pthread_mutex_lock(&io_lock);
+    struct transfer *transfer;
+    for (transfer = transfers; transfer != NULL; transfer = transfer->next) {
+        if (transfer->id == id) {
+            transfer->resume = true;
+            curl_multi_wakeup(multi);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&io_lock);
+}
@@ -0,0 +1,23 @@
+#include <stdbool.h>
+
+#include <curl/curl.h>
+
+// Runs transfers concurrently on one I/O thread driving a curl multi
+// handle, so nothing else blocks while a request is in flight.
+
+// Called on the I/O thread once handle's transfer has finished, failed or
+// been cancelled (CURLE_ABORTED_BY_CALLBACK). The handle is back in the
+// caller's hands by then.
+typedef void (*http_io_done_t)(CURLcode result, void *data);
+
+// Starts the transfer handle is set up for. Transfers beyond the per-host
+// limit wait for one to the same host to finish. Returns the transfer's
+// id (never 0), or 0 if it couldn't be started.
+unsigned long http_io_start(CURL *handle, http_io_done_t done, void *data);
+
+// Returns false if id has already finished.
+bool http_io_cancel(unsigned long id);
+
+// Restarts a transfer its write callback paused with
+// CURL_WRITEFUNC_PAUSE. Does nothing if id has finished.
+void http_io_resume(unsigned long id);
@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "http_pool.h"
+
+// The pool keeps up to HTTP_POOL_MAX_IDLE_HANDLES handles between
+// requests; more can be out at once, and the extra ones are cleaned up as
+// they come back. The connection cache is bounded the same way, and
+// connections idle for longer than HTTP_POOL_MAX_IDLE_SECONDS are closed
+// rather than reused.
+//
+// Connections are only shared between handles for synchronous requests,
+// which all run on the JS thread: curl doesn't allow a shared connection
+// cache to be used from two threads at once, and HTTP/2 multiplexing
+// doesn't work across one. Handles for http_io_start use the multi
+// handle's own connection cache instead, and share only DNS and TLS
+// sessions, through a share of their own.
+//
+// The CA bundle is handed to curl from memory where curl supports it
+// (7.77.0), so the file is read once rather than once per handshake.
+
+#define HTTP_POOL_MAX_IDLE_HANDLES 4
+#define HTTP_POOL_MAX_IDLE_CONNECTIONS 8
+#define HTTP_POOL_MAX_IDLE_SECONDS 60
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
+
+static CURLSH *share = NULL;
+static CURLSH *io_share = NULL;
+// The two shares' locks, one per kind of data in each.
+static pthread_mutex_t share_locks[2][CURL_LOCK_DATA_LAST];
+
+static const char *ca_path = NULL;
+static char *ca_data = NULL;
+static size_t ca_length = 0;
+
+static CURL *idle[HTTP_POOL_MAX_IDLE_HANDLES];
+static size_t idle_count = 0;
+
+static struct http_pool_stats stats;
+
+void http_pool_set_ca_path(const char *path) {
+    pthread_mutex_lock(&pool_lock);
+    ca_path = path;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    pthread_mutex_lock(&((pthread_mutex_t *) userptr)[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    pthread_mutex_unlock(&((pthread_mutex_t *) userptr)[data]);
+}
+
+static CURLSH *share_init(pthread_mutex_t *locks, bool connections) {
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    CURLSH *new_share = curl_share_init();
+    if (new_share != NULL) {
+        curl_share_setopt(new_share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(new_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(new_share, CURLSHOPT_USERDATA, locks);
+        curl_share_setopt(new_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(new_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        if (connections) {
+            curl_share_setopt(new_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        }
+#endif
+    }
+    return new_share;
+}
+
+static void read_ca_bundle(void) {
+    if (ca_path == NULL) {
+        return;
+    }
+    FILE *f = fopen(ca_path, "rb");
+    if (f == NULL) {
+        return;
+    }
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long length = ftell(f);
+        if (length > 0 && fseek(f, 0, SEEK_SET) == 0) {
+            ca_data = malloc(length);
+            if (ca_data != NULL && fread(ca_data, 1, length, f) == (size_t) length) {
+                ca_length = length;
+            } else {
+                free(ca_data);
+                ca_data = NULL;
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void pool_init(void) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    share = share_init(share_locks[0], true);
+    io_share = share_init(share_locks[1], false);
+
+#if LIBCURL_VERSION_NUM >= 0x074d00
+    read_ca_bundle();
+#endif
+
+    initialized = true;
+}
+
+// Everything curl_easy_reset clears that every request needs.
+static void set_defaults(CURL *handle, bool async) {
+    CURLSH *handle_share = async ? io_share : share;
+    if (handle_share != NULL) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, handle_share);
+    }
+#if LIBCURL_VERSION_NUM >= 0x074d00
+    if (ca_data != NULL) {
+        struct curl_blob blob = {ca_data, ca_length, CURL_BLOB_NOCOPY};
+        curl_easy_setopt(handle, CURLOPT_CAINFO_BLOB, &blob);
+    } else
+#endif
+    if (ca_path != NULL) {
+        curl_easy_setopt(handle, CURLOPT_CAINFO, ca_path);
+    }
+    curl_easy_setopt(handle, CURLOPT_MAXCONNECTS, (long) HTTP_POOL_MAX_IDLE_CONNECTIONS);
+#if LIBCURL_VERSION_NUM >= 0x074100
+    curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, (long) HTTP_POOL_MAX_IDLE_SECONDS);
+#endif
+}
+
+CURL *http_pool_acquire(bool async) {
+    pthread_mutex_lock(&pool_lock);
+    if (!initialized) {
+        pool_init();
+    }
+    CURL *handle = NULL;
+    if (idle_count > 0) {
+        handle = idle[--idle_count];
+    } else {
+        handle = curl_easy_init();
+        if (handle != NULL) {
+            stats.handles_created++;
+        }
+    }
+    if (handle != NULL) {
+        set_defaults(handle, async);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return handle;
+}
+
+void http_pool_release(CURL *handle) {
+    if (handle == NULL) {
+        return;
+    }
+
+    long connects = 0;
+    bool performed = curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK;
+    long status = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_reset(handle);
+
+    pthread_mutex_lock(&pool_lock);
+    if (performed && (connects > 0 || status != 0)) {
+        stats.requests++;
+        if (connects > 0) {
+            stats.new_connections += connects;
+        } else {
+            stats.reused_connections++;
+        }
+    }
+    if (idle_count < HTTP_POOL_MAX_IDLE_HANDLES) {
+        idle[idle_count++] = handle;
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (handle != NULL) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+void http_pool_get_stats(struct http_pool_stats *out) {
+    pthread_mutex_lock(&pool_lock);
+    *out = stats;
+    out->idle_handles = idle_count;
+    pthread_mutex_unlock(&pool_lock);
+}
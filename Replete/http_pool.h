@@ -0,0 +1,30 @@
+#include <stdbool.h>
+
+#include <curl/curl.h>
+
+// Easy handles for REPLETE_REQUEST, reused rather than created per request.
+// Handles share a DNS cache, a TLS session cache and a connection cache,
+// the last kept apart for async requests, so a request to a host that was
+// recently talked to skips the connect and the full handshake.
+
+// The CA bundle every handle verifies against. Read once, on first use.
+void http_pool_set_ca_path(const char *path);
+
+// A handle with no options set beyond the shared caches and CA bundle, or
+// NULL if one couldn't be made. A handle for http_io_start is async, and
+// doesn't share connections with the rest. Safe from any thread.
+CURL *http_pool_acquire(bool async);
+
+// Returns handle to the pool once its transfer is done, noting whether the
+// transfer reused a connection.
+void http_pool_release(CURL *handle);
+
+struct http_pool_stats {
+    unsigned long requests;
+    unsigned long new_connections;
+    unsigned long reused_connections;
+    unsigned long handles_created;
+    size_t idle_handles;
+};
+
+void http_pool_get_stats(struct http_pool_stats *stats);
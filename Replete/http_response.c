@@ -0,0 +1,281 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+#include "http_response.h"
+
+// A header is its name and value, split apart in the header block itself,
+// so both are nul-terminated there and the table only needs offsets.
+struct header_field {
+    uint32_t name;
+    uint32_t value;
+};
+
+enum response_property {
+    RESPONSE_STATUS,
+    RESPONSE_HEADERS,
+    RESPONSE_BODY,
+    RESPONSE_ERROR,
+    RESPONSE_PROTOCOL,
+    RESPONSE_WIRE_BYTES,
+    RESPONSE_BODY_BYTES,
+    RESPONSE_PROPERTIES
+};
+
+static const char *const property_names[RESPONSE_PROPERTIES] = {
+        "status", "headers", "body", "error", "protocol", "wire-bytes", "body-bytes"
+};
+
+struct response_data {
+    struct http_response response;
+    struct header_field *fields;
+    size_t field_count;
+    // A bit per property that is now an ordinary property of the object.
+    unsigned materialized;
+};
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Splits the header on one line of the block, if it is one, into the table.
+static void parse_header_line(struct response_data *data, size_t line_start, size_t line_end) {
+    char *headers = data->response.headers;
+
+    // Each response in the block, after a redirect or a 100 Continue,
+    // starts with its status line; only the last one's headers are kept.
+    if (line_end - line_start >= 5 && strncmp(headers + line_start, "HTTP/", 5) == 0) {
+        data->field_count = 0;
+        return;
+    }
+
+    char *colon = memchr(headers + line_start, ':', line_end - line_start);
+    if (colon == NULL) { // likely empty?
+        return;
+    }
+    size_t name_end = colon - headers;
+
+    size_t val_start = name_end + 1;
+    while (val_start < line_end && is_blank(headers[val_start])) {
+        val_start++;
+    }
+    size_t val_end = line_end;
+    while (val_end > val_start && (is_blank(headers[val_end - 1]) || headers[val_end - 1] == '\r')) {
+        val_end--;
+    }
+
+    headers[name_end] = '\0';
+    headers[val_end] = '\0';
+    data->fields[data->field_count++] = (struct header_field) {(uint32_t) line_start, (uint32_t) val_start};
+}
+
+static void parse_headers(struct response_data *data) {
+    const char *headers = data->response.headers;
+    size_t length = data->response.headers_length;
+    if (headers == NULL || length == 0 || length > UINT32_MAX) {
+        return;
+    }
+
+    size_t lines = 1;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        if (headers[i] == '\n') {
+            lines++;
+        }
+    }
+    data->fields = malloc(lines * sizeof(struct header_field));
+    if (data->fields == NULL) {
+        return;
+    }
+
+    size_t line_start = 0;
+    for (i = 0; i < length; i++) {
+        if (headers[i] == '\n') {
+            parse_header_line(data, line_start, i);
+            line_start = i + 1;
+        }
+    }
+    if (line_start < length) {
+        parse_header_line(data, line_start, length);
+    }
+}
+
+static JSValueRef make_string(JSContextRef ctx, const char *s) {
+    JSStringRef str = JSStringCreateWithUTF8CString(s);
+    JSValueRef value = JSValueMakeString(ctx, str);
+    JSStringRelease(str);
+    return value;
+}
+
+static JSObjectRef make_headers(JSContextRef ctx, struct response_data *data) {
+    JSObjectRef headers = JSObjectMake(ctx, NULL, NULL);
+    size_t i;
+    for (i = 0; i < data->field_count; i++) {
+        JSStringRef name_str = JSStringCreateWithUTF8CString(data->response.headers + data->fields[i].name);
+        JSObjectSetProperty(ctx, headers, name_str, make_string(ctx, data->response.headers + data->fields[i].value),
+                            kJSPropertyAttributeReadOnly, NULL);
+        JSStringRelease(name_str);
+    }
+    return headers;
+}
+
+static void free_body(void *bytes, void *context) {
+    free(bytes);
+}
+
+static JSValueRef make_body(JSContextRef ctx, struct response_data *data) {
+    struct http_response *response = &data->response;
+    if (!response->binary) {
+        JSValueRef body = make_string(ctx, response->body);
+        free(response->body);
+        response->body = NULL;
+        return body;
+    }
+
+    // The Uint8Array takes over the receive buffer rather than copying
+    // it, and frees it when collected. Growing it by doubling can leave a
+    // lot unused, so that is handed back first.
+    char *trimmed = realloc(response->body, response->body_length + 1);
+    if (trimmed != NULL) {
+        response->body = trimmed;
+    }
+    JSObjectRef bytes = JSObjectMakeTypedArrayWithBytesNoCopy(ctx, kJSTypedArrayTypeUint8Array,
+                                                              response->body, response->body_length,
+                                                              free_body, NULL, NULL);
+    if (bytes != NULL) {
+        response->body = NULL;
+    }
+    return bytes;
+}
+
+static int property_index(JSStringRef name) {
+    int i;
+    for (i = 0; i < RESPONSE_PROPERTIES; i++) {
+        if (JSStringIsEqualToUTF8CString(name, property_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Whether the property is still ours to make, rather than absent or
+// already an ordinary property.
+static bool is_pending(struct response_data *data, int index) {
+    if (data == NULL || index < 0 || (data->materialized & (1u << index))) {
+        return false;
+    }
+    switch (index) {
+        case RESPONSE_BODY:
+            return data->response.body != NULL;
+        case RESPONSE_ERROR:
+            return data->response.error != NULL;
+        case RESPONSE_PROTOCOL:
+            return data->response.protocol != NULL;
+        default:
+            return true;
+    }
+}
+
+static bool response_has_property(JSContextRef ctx, JSObjectRef object, JSStringRef name) {
+    return is_pending(JSObjectGetPrivate(object), property_index(name));
+}
+
+// Makes the property's value the first time it is asked for, then sets it
+// on the object, so from then on it is found like any other property.
+static JSValueRef response_get_property(JSContextRef ctx, JSObjectRef object, JSStringRef name,
+                                        JSValueRef *exception) {
+    struct response_data *data = JSObjectGetPrivate(object);
+    int index = property_index(name);
+    if (!is_pending(data, index)) {
+        return NULL;
+    }
+
+    JSValueRef value = NULL;
+    switch (index) {
+        case RESPONSE_STATUS:
+            value = JSValueMakeNumber(ctx, data->response.status);
+            break;
+        case RESPONSE_HEADERS:
+            value = make_headers(ctx, data);
+            // The names and values are in JS strings now.
+            free(data->fields);
+            data->fields = NULL;
+            data->field_count = 0;
+            free(data->response.headers);
+            data->response.headers = NULL;
+            break;
+        case RESPONSE_BODY:
+            value = make_body(ctx, data);
+            break;
+        case RESPONSE_ERROR:
+            value = make_string(ctx, data->response.error);
+            break;
+        case RESPONSE_PROTOCOL:
+            value = make_string(ctx, data->response.protocol);
+            break;
+        case RESPONSE_WIRE_BYTES:
+            value = JSValueMakeNumber(ctx, data->response.wire_bytes);
+            break;
+        case RESPONSE_BODY_BYTES:
+            value = JSValueMakeNumber(ctx, data->response.body_bytes);
+            break;
+    }
+    if (value == NULL) {
+        return NULL;
+    }
+
+    data->materialized |= 1u << index;
+    JSObjectSetProperty(ctx, object, name, value, kJSPropertyAttributeReadOnly, NULL);
+    return value;
+}
+
+static void response_get_property_names(JSContextRef ctx, JSObjectRef object,
+                                        JSPropertyNameAccumulatorRef property_names_accumulator) {
+    struct response_data *data = JSObjectGetPrivate(object);
+    int i;
+    for (i = 0; i < RESPONSE_PROPERTIES; i++) {
+        if (is_pending(data, i)) {
+            JSStringRef name_str = JSStringCreateWithUTF8CString(property_names[i]);
+            JSPropertyNameAccumulatorAddName(property_names_accumulator, name_str);
+            JSStringRelease(name_str);
+        }
+    }
+}
+
+static void response_finalize(JSObjectRef object) {
+    struct response_data *data = JSObjectGetPrivate(object);
+    if (data != NULL) {
+        free(data->fields);
+        free(data->response.headers);
+        free(data->response.body);
+        free(data);
+    }
+}
+
+static JSClassRef response_class(void) {
+    static JSClassRef js_class = NULL;
+    if (js_class == NULL) {
+        JSClassDefinition definition = kJSClassDefinitionEmpty;
+        definition.className = "HTTPResponse";
+        definition.hasProperty = response_has_property;
+        definition.getProperty = response_get_property;
+        definition.getPropertyNames = response_get_property_names;
+        definition.finalize = response_finalize;
+        js_class = JSClassCreate(&definition);
+    }
+    return js_class;
+}
+
+JSObjectRef http_response_make(JSContextRef ctx, const struct http_response *response) {
+    struct response_data *data = calloc(1, sizeof(struct response_data));
+    if (data == NULL) {
+        free(response->headers);
+        free(response->body);
+        return JSObjectMake(ctx, NULL, NULL);
+    }
+    data->response = *response;
+    parse_headers(data);
+    return JSObjectMake(ctx, response_class(), data);
+}
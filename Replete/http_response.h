@@ -0,0 +1,31 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+// The object REPLETE_REQUEST hands back for a response. It keeps what was
+// received natively, the headers as a table over the raw header block and
+// the body as the bytes that came, and only makes a JS value of each the
+// first time it is read. A response whose headers or body go unread costs
+// next to nothing on the JS heap.
+
+struct http_response {
+    long status;
+    // Static strings, or NULL if there is none.
+    const char *error;
+    const char *protocol;
+    double wire_bytes;
+    double body_bytes;
+    // The raw header block, status lines included, and the body, each
+    // nul-terminated or NULL. The response object takes these over.
+    char *headers;
+    size_t headers_length;
+    char *body;
+    size_t body_length;
+    // The body is a Uint8Array rather than a string.
+    bool binary;
+};
+
+// Makes the object for response, taking over its buffers. On the JS
+// thread.
+JSObjectRef http_response_make(JSContextRef ctx, const struct http_response *response);
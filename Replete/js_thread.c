@@ -0,0 +1,234 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "js_thread.h"
+#include "watchdog.h"
+
+// Tasks are posted from any number of threads and taken by the JS thread
+// alone; the queue lock is only held to link or unlink one node. Since all
+// JavaScript runs on this thread, nothing else needs to lock the context.
+
+struct task_node {
+    js_task_t task;
+    void *data;
+    enum js_task_kind kind;
+    uint64_t posted;
+    struct task_node *next;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct task_node *queue_head = NULL;
+static struct task_node *queue_tail = NULL;
+
+static bool started = false;
+static __thread bool on_js_thread = false;
+
+// Only touched on the JS thread.
+static struct task_node *microtask_head = NULL;
+static struct task_node *microtask_tail = NULL;
+
+static struct js_thread_stats stats;
+static bool busy = false;
+static uint64_t current_started = 0;
+
+static const char *kind_names[JS_TASK_KINDS] = {
+    "other", "startup", "eval", "timer", "io", "ui"
+};
+
+const char *js_task_kind_name(enum js_task_kind kind) {
+    return kind < JS_TASK_KINDS ? kind_names[kind] : "other";
+}
+
+static uint64_t now_micros(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static void record(unsigned long *histogram, uint64_t micros) {
+    int bucket = 0;
+    while (bucket < JS_THREAD_HISTOGRAM_BUCKETS - 1 && micros >= (1ULL << bucket)) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+// Runs under the watchdog like any task. If it stops the drain, whatever
+// is left runs after the tasks queued meanwhile, so a microtask that keeps
+// queueing another can't hold them up past the time limit.
+static unsigned long drain_microtasks(void) {
+    if (microtask_head == NULL) {
+        return 0;
+    }
+    unsigned long count = 0;
+    watchdog_begin();
+    while (microtask_head != NULL) {
+        struct task_node *node = microtask_head;
+        microtask_head = node->next;
+        if (microtask_head == NULL) {
+            microtask_tail = NULL;
+        }
+        node->task(node->data);
+        free(node);
+        count++;
+        if (watchdog_check() != WATCHDOG_NONE) {
+            break;
+        }
+    }
+    enum watchdog_reason reason = watchdog_end();
+    if (reason == WATCHDOG_TIMED_OUT) {
+        fprintf(stderr, "Microtasks stopped after running too long\n");
+    } else if (reason == WATCHDOG_INTERRUPTED) {
+        fprintf(stderr, "Microtasks interrupted\n");
+    }
+    return count;
+}
+
+static void *js_thread_main(void *arg) {
+    on_js_thread = true;
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == NULL && microtask_head == NULL) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (queue_head == NULL) {
+            // Left over from a drain the watchdog stopped.
+            pthread_mutex_unlock(&queue_lock);
+            unsigned long microtasks = drain_microtasks();
+            pthread_mutex_lock(&queue_lock);
+            stats.microtasks += microtasks;
+            pthread_mutex_unlock(&queue_lock);
+            continue;
+        }
+        struct task_node *node = queue_head;
+        queue_head = node->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        stats.queued--;
+        stats.tasks++;
+        enum js_task_kind kind = node->kind;
+        uint64_t started = now_micros();
+        record(stats.wait_micros, started - node->posted);
+        busy = true;
+        stats.current = kind;
+        current_started = started;
+        pthread_mutex_unlock(&queue_lock);
+
+        node->task(node->data);
+        free(node);
+        unsigned long microtasks = drain_microtasks();
+
+        uint64_t finished = now_micros();
+        pthread_mutex_lock(&queue_lock);
+        record(stats.run_micros, finished - started);
+        stats.kind_tasks[kind]++;
+        stats.kind_run_micros[kind] += finished - started;
+        stats.microtasks += microtasks;
+        busy = false;
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+void js_thread_start(void) {
+    pthread_mutex_lock(&queue_lock);
+    if (!started) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        // The compiler recurses deeply; match the main thread's stack.
+        pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, js_thread_main, NULL) == 0) {
+            started = true;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+bool js_thread_is_current(void) {
+    return on_js_thread;
+}
+
+void js_thread_post(enum js_task_kind kind, js_task_t task, void *data) {
+    struct task_node *node = malloc(sizeof(struct task_node));
+    node->task = task;
+    node->data = data;
+    node->kind = kind < JS_TASK_KINDS ? kind : JS_TASK_OTHER;
+    node->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    node->posted = now_micros();
+    if (busy || queue_head != NULL) {
+        stats.contended++;
+    }
+    if (queue_tail != NULL) {
+        queue_tail->next = node;
+    } else {
+        queue_head = node;
+    }
+    queue_tail = node;
+    if (++stats.queued > stats.max_queued) {
+        stats.max_queued = stats.queued;
+    }
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+struct sync_task {
+    js_task_t task;
+    void *data;
+    bool done;
+};
+
+static void run_sync_task(void *data) {
+    struct sync_task *sync = data;
+    sync->task(sync->data);
+    pthread_mutex_lock(&queue_lock);
+    sync->done = true;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void js_thread_run(enum js_task_kind kind, js_task_t task, void *data) {
+    if (js_thread_is_current()) {
+        task(data);
+        return;
+    }
+
+    struct sync_task sync = {task, data, false};
+    js_thread_post(kind, run_sync_task, &sync);
+    pthread_mutex_lock(&queue_lock);
+    while (!sync.done) {
+        pthread_cond_wait(&done_cond, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void js_thread_queue_microtask(js_task_t task, void *data) {
+    struct task_node *node = malloc(sizeof(struct task_node));
+    node->task = task;
+    node->data = data;
+    node->next = NULL;
+    if (microtask_tail != NULL) {
+        microtask_tail->next = node;
+    } else {
+        microtask_head = node;
+    }
+    microtask_tail = node;
+}
+
+void js_thread_get_stats(struct js_thread_stats *out) {
+    pthread_mutex_lock(&queue_lock);
+    *out = stats;
+    out->running = busy;
+    out->current_micros = busy ? now_micros() - current_started : 0;
+    pthread_mutex_unlock(&queue_lock);
+}
@@ -0,0 +1,61 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// The one thread that runs JavaScript. Everything else (REPL evaluations,
+// timers, I/O completions) posts tasks to it, which it runs in order,
+// draining the microtask queue after each.
+
+typedef void (*js_task_t)(void *data);
+
+// What a task is for, so the stats can say what is keeping the thread busy.
+enum js_task_kind {
+    JS_TASK_OTHER,
+    JS_TASK_STARTUP,
+    JS_TASK_EVAL,
+    JS_TASK_TIMER,
+    JS_TASK_IO,
+    JS_TASK_UI,
+    JS_TASK_KINDS
+};
+
+const char *js_task_kind_name(enum js_task_kind kind);
+
+void js_thread_start(void);
+
+bool js_thread_is_current(void);
+
+// Safe from any thread.
+void js_thread_post(enum js_task_kind kind, js_task_t task, void *data);
+
+// Posts task and waits for it to have run; on the JS thread, runs it
+// straight away.
+void js_thread_run(enum js_task_kind kind, js_task_t task, void *data);
+
+// JS thread only. Runs after the current task, before the next one,
+// unless the watchdog stops the drain; then it waits its turn behind them.
+void js_thread_queue_microtask(js_task_t task, void *data);
+
+// Waits and runs of under 1 us, 1-2 us, 2-4 us, ... ; the last bucket
+// takes the rest.
+#define JS_THREAD_HISTOGRAM_BUCKETS 24
+
+struct js_thread_stats {
+    unsigned long tasks;
+    unsigned long microtasks;
+    size_t queued;
+    size_t max_queued;
+    // Tasks posted while another was running or waiting.
+    unsigned long contended;
+    // From being posted to starting, and from starting to having drained
+    // the microtasks it queued.
+    unsigned long wait_micros[JS_THREAD_HISTOGRAM_BUCKETS];
+    unsigned long run_micros[JS_THREAD_HISTOGRAM_BUCKETS];
+    unsigned long kind_tasks[JS_TASK_KINDS];
+    double kind_run_micros[JS_TASK_KINDS];
+    // The task running now, if any, and for how long so far.
+    bool running;
+    enum js_task_kind current;
+    double current_micros;
+};
+
+void js_thread_get_stats(struct js_thread_stats *stats);
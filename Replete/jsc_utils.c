@@ -5,6 +5,12 @@
 #include <JavaScriptCore/JavaScript.h>
 
 #include "jsc_utils.h"
+#include "trace.h"
+
+// Exported by JavaScriptCore but only declared in its private
+// JSStringRefPrivate.h. Weakly linked, so utf16_to_string can fall
+// back to copying if it ever goes away.
+JS_EXPORT JSStringRef JSStringCreateWithCharactersNoCopy(const JSChar *chars, size_t numChars) __attribute__((weak));
 
 JSStringRef to_string(JSContextRef ctx, JSValueRef val) {
     if (JSValueIsUndefined(ctx, val)) {
@@ -31,16 +37,16 @@ void print_value(char *prefix, JSContextRef ctx, JSValueRef val) {
     }
 }
 
-JSValueRef evaluate_script(JSContextRef ctx, char *script, char *source) {
-    JSStringRef script_ref = JSStringCreateWithUTF8CString(script);
+JSValueRef evaluate_script_string(JSContextRef ctx, JSStringRef script, char *source) {
     JSStringRef source_ref = NULL;
     if (source != NULL) {
         source_ref = JSStringCreateWithUTF8CString(source);
     }
     
     JSValueRef ex = NULL;
-    JSValueRef val = JSEvaluateScript(ctx, script_ref, NULL, source_ref, 0, &ex);
-    JSStringRelease(script_ref);
+    TRACE_BEGIN("eval", source);
+    JSValueRef val = JSEvaluateScript(ctx, script, NULL, source_ref, 0, &ex);
+    TRACE_END("eval");
     if (source != NULL) {
         JSStringRelease(source_ref);
     }
@@ -50,6 +56,23 @@ JSValueRef evaluate_script(JSContextRef ctx, char *script, char *source) {
     return val;
 }
 
+JSValueRef evaluate_script(JSContextRef ctx, char *script, char *source) {
+    JSStringRef script_ref = JSStringCreateWithUTF8CString(script);
+    JSValueRef val = evaluate_script_string(ctx, script_ref, source);
+    JSStringRelease(script_ref);
+    return val;
+}
+
+// Wraps UTF-16 source without transcoding it. Unless the no-copy string
+// constructor is missing, JavaScriptCore uses the characters in place, so
+// they must stay valid for as long as the context lives.
+JSStringRef utf16_to_string(const unsigned short *chars, size_t length) {
+    if (JSStringCreateWithCharactersNoCopy != NULL) {
+        return JSStringCreateWithCharactersNoCopy(chars, length);
+    }
+    return JSStringCreateWithCharacters(chars, length);
+}
+
 char *value_to_c_string_ext(JSContextRef ctx, JSValueRef val, bool handle_non_string_values) {
     
     if (!handle_non_string_values && JSValueIsNull(ctx, val)) {
@@ -12,6 +12,10 @@ void print_value(char *prefix, JSContextRef ctx, JSValueRef val);
 
 JSValueRef evaluate_script(JSContextRef ctx, char *script, char *source);
 
+JSValueRef evaluate_script_string(JSContextRef ctx, JSStringRef script, char *source);
+
+JSStringRef utf16_to_string(const unsigned short *chars, size_t length);
+
 char *value_to_c_string(JSContextRef ctx, JSValueRef val);
 
 char* value_to_c_string_ext(JSContextRef ctx, JSValueRef val, bool handle_non_string_values);
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "path_set.h"
+
+#define PATH_SET_MIN_CAPACITY 1024
+
+static unsigned long hash_path(const char *path) {
+    unsigned long hash = 5381;
+    int c;
+    
+    while ((c = (unsigned char) *path++))
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    
+    return hash;
+}
+
+// The slot holding path, or the empty slot where it would go.
+static size_t path_set_slot(struct path_set *set, const char *path, unsigned long hash) {
+    size_t mask = set->capacity - 1;
+    size_t i = hash & mask;
+    while (set->keys[i] != NULL) {
+        if (set->hashes[i] == hash && strcmp(set->keys[i], path) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static bool path_set_grow(struct path_set *set) {
+    size_t capacity = set->capacity ? set->capacity * 2 : PATH_SET_MIN_CAPACITY;
+    char **keys = calloc(capacity, sizeof(char *));
+    unsigned long *hashes = calloc(capacity, sizeof(unsigned long));
+    if (keys == NULL || hashes == NULL) {
+        free(keys);
+        free(hashes);
+        return false;
+    }
+    
+    struct path_set grown = {keys, hashes, set->count, capacity};
+    size_t i;
+    for (i = 0; i < set->capacity; i++) {
+        if (set->keys[i] != NULL) {
+            size_t slot = path_set_slot(&grown, set->keys[i], set->hashes[i]);
+            grown.keys[slot] = set->keys[i];
+            grown.hashes[slot] = set->hashes[i];
+        }
+    }
+    free(set->keys);
+    free(set->hashes);
+    *set = grown;
+    return true;
+}
+
+bool path_set_contains(struct path_set *set, const char *path) {
+    if (set->count == 0) {
+        return false;
+    }
+    return set->keys[path_set_slot(set, path, hash_path(path))] != NULL;
+}
+
+bool path_set_add(struct path_set *set, const char *path) {
+    // Kept at most half full, so probe runs stay short.
+    if ((set->count + 1) * 2 > set->capacity && !path_set_grow(set)) {
+        return true;
+    }
+    
+    unsigned long hash = hash_path(path);
+    size_t slot = path_set_slot(set, path, hash);
+    if (set->keys[slot] != NULL) {
+        return false;
+    }
+    char *key = strdup(path);
+    if (key == NULL) {
+        return true;
+    }
+    set->keys[slot] = key;
+    set->hashes[slot] = hash;
+    set->count++;
+    return true;
+}
+
+void path_set_clear(struct path_set *set) {
+    size_t i;
+    for (i = 0; i < set->capacity; i++) {
+        free(set->keys[i]);
+    }
+    free(set->keys);
+    free(set->hashes);
+    set->keys = NULL;
+    set->hashes = NULL;
+    set->count = 0;
+    set->capacity = 0;
+}
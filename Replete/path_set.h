@@ -0,0 +1,18 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// A set of paths, open addressing with full-key comparison. A zeroed
+// struct is an empty set; it grows as paths are added.
+struct path_set {
+    char **keys;
+    unsigned long *hashes;
+    size_t count;
+    size_t capacity;
+};
+
+bool path_set_contains(struct path_set *set, const char *path);
+
+// Adds a copy of path. Returns false if it was already there.
+bool path_set_add(struct path_set *set, const char *path);
+
+void path_set_clear(struct path_set *set);
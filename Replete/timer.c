@@ -0,0 +1,429 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timer.h"
+
+// Pending timers sit in a binary min-heap ordered by deadline, on the
+// monotonic clock. Each timer lives in a slot that records its position in
+// the heap, so cancelling one is a heap removal rather than a search.
+//
+// Timers that come due together, or within a small slack of each other,
+// are handed to their callback as one batch, so JS is entered once for
+// all of them rather than once per timer.
+//
+// A timer id is the slot index plus the slot's generation, which changes
+// every time the slot is reused, so a stale id never cancels a newer timer.
+
+#define SLOT_BITS 24
+#define SLOT_MASK ((1UL << SLOT_BITS) - 1)
+#define GENERATION_MASK ((1UL << 29) - 1)
+#define NOT_IN_HEAP SIZE_MAX
+#define TIMER_DEFAULT_SLACK_MILLIS 1
+
+struct timer {
+    uint64_t deadline;
+    long period_millis;
+    timer_callback_t callback;
+    void *data;
+    unsigned long generation;
+    size_t heap_index;
+    bool active;
+    bool running;
+    bool cancelled;
+};
+
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static bool thread_started = false;
+
+static struct timer *slots = NULL;
+static size_t slot_count = 0;
+static size_t slot_capacity = 0;
+
+static size_t *free_slots = NULL;
+static size_t free_count = 0;
+
+static size_t *batch_slots = NULL;
+// The id each batch slot had when it was taken, to tell whether the slot
+// still holds that timer once the callback has run.
+static unsigned long *batch_slot_ids = NULL;
+static unsigned long *batch_ids = NULL;
+static size_t batch_capacity = 0;
+
+static uint64_t slack_nanos = TIMER_DEFAULT_SLACK_MILLIS * 1000000;
+static struct timer_stats stats;
+
+static size_t *heap = NULL;
+static size_t heap_count = 0;
+static size_t heap_capacity = 0;
+
+static uint64_t now_nanos(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static unsigned long timer_id(size_t slot) {
+    return (slots[slot].generation << SLOT_BITS) | slot;
+}
+
+static bool heap_less(size_t a, size_t b) {
+    return slots[heap[a]].deadline < slots[heap[b]].deadline;
+}
+
+static void heap_swap(size_t a, size_t b) {
+    size_t tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    slots[heap[a]].heap_index = a;
+    slots[heap[b]].heap_index = b;
+}
+
+static void heap_up(size_t i) {
+    while (i > 0 && heap_less(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < heap_count && heap_less(left, smallest)) {
+            smallest = left;
+        }
+        if (right < heap_count && heap_less(right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static bool heap_push(size_t slot) {
+    if (heap_count == heap_capacity) {
+        size_t capacity = heap_capacity ? heap_capacity * 2 : 64;
+        size_t *grown = realloc(heap, capacity * sizeof(size_t));
+        if (grown == NULL) {
+            return false;
+        }
+        heap = grown;
+        heap_capacity = capacity;
+    }
+    heap[heap_count] = slot;
+    slots[slot].heap_index = heap_count;
+    heap_count++;
+    heap_up(heap_count - 1);
+    return true;
+}
+
+static void heap_remove(size_t i) {
+    slots[heap[i]].heap_index = NOT_IN_HEAP;
+    heap_count--;
+    if (i == heap_count) {
+        return;
+    }
+    heap[i] = heap[heap_count];
+    slots[heap[i]].heap_index = i;
+    heap_down(i);
+    heap_up(i);
+}
+
+static size_t slot_alloc(void) {
+    if (free_count > 0) {
+        return free_slots[--free_count];
+    }
+    if (slot_count == slot_capacity) {
+        size_t capacity = slot_capacity ? slot_capacity * 2 : 64;
+        if (capacity > SLOT_MASK + 1) {
+            return NOT_IN_HEAP;
+        }
+        struct timer *grown = realloc(slots, capacity * sizeof(struct timer));
+        if (grown == NULL) {
+            return NOT_IN_HEAP;
+        }
+        slots = grown;
+        size_t *grown_free = realloc(free_slots, capacity * sizeof(size_t));
+        if (grown_free == NULL) {
+            return NOT_IN_HEAP;
+        }
+        free_slots = grown_free;
+        slot_capacity = capacity;
+    }
+    slots[slot_count].generation = 0;
+    return slot_count++;
+}
+
+static void slot_free(size_t slot) {
+    slots[slot].active = false;
+    free_slots[free_count++] = slot;
+}
+
+static void wait_until(uint64_t deadline) {
+#ifdef __APPLE__
+    uint64_t now = now_nanos();
+    if (deadline <= now) {
+        return;
+    }
+    uint64_t wait = deadline - now;
+    struct timespec t;
+    t.tv_sec = wait / 1000000000;
+    t.tv_nsec = wait % 1000000000;
+    pthread_cond_timedwait_relative_np(&timer_cond, &timer_lock, &t);
+#else
+    struct timespec t;
+    t.tv_sec = deadline / 1000000000;
+    t.tv_nsec = deadline % 1000000000;
+    pthread_cond_timedwait(&timer_cond, &timer_lock, &t);
+#endif
+}
+
+static bool batch_reserve(size_t count) {
+    if (count <= batch_capacity) {
+        return true;
+    }
+    size_t capacity = batch_capacity ? batch_capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    size_t *grown_slots = realloc(batch_slots, capacity * sizeof(size_t));
+    if (grown_slots == NULL) {
+        return false;
+    }
+    batch_slots = grown_slots;
+    unsigned long *grown_ids = realloc(batch_ids, capacity * sizeof(unsigned long));
+    if (grown_ids == NULL) {
+        return false;
+    }
+    batch_ids = grown_ids;
+    unsigned long *grown_slot_ids = realloc(batch_slot_ids, capacity * sizeof(unsigned long));
+    if (grown_slot_ids == NULL) {
+        return false;
+    }
+    batch_slot_ids = grown_slot_ids;
+    batch_capacity = capacity;
+    return true;
+}
+
+static void record_batch(size_t count) {
+    stats.batches++;
+    stats.fired += count;
+    if (count > stats.max_batch) {
+        stats.max_batch = count;
+    }
+    int bucket = 0;
+    while (bucket < TIMER_BATCH_BUCKETS - 1 && count >= (2UL << bucket)) {
+        bucket++;
+    }
+    stats.batch_sizes[bucket]++;
+}
+
+static void *timer_thread(void *arg) {
+    pthread_mutex_lock(&timer_lock);
+    for (;;) {
+        if (heap_count == 0) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+        uint64_t now = now_nanos();
+        if (slots[heap[0]].deadline > now) {
+            wait_until(slots[heap[0]].deadline);
+            continue;
+        }
+
+        // Everything due now or within the slack goes out in this batch.
+        uint64_t horizon = now + slack_nanos;
+        size_t count = 0;
+        while (heap_count > 0 && slots[heap[0]].deadline <= horizon && batch_reserve(count + 1)) {
+            size_t slot = heap[0];
+            heap_remove(0);
+            slots[slot].running = true;
+            batch_slot_ids[count] = timer_id(slot);
+            batch_slots[count++] = slot;
+        }
+        record_batch(count);
+
+        // Calls each distinct callback once, with its timers' ids in
+        // deadline order.
+        size_t i, j;
+        for (i = 0; i < count; i++) {
+            if (batch_slots[i] == NOT_IN_HEAP) {
+                continue;
+            }
+            timer_callback_t callback = slots[batch_slots[i]].callback;
+            void *data = slots[batch_slots[i]].data;
+            size_t group_count = 0;
+            for (j = i; j < count; j++) {
+                if (batch_slots[j] != NOT_IN_HEAP && slots[batch_slots[j]].callback == callback
+                    && slots[batch_slots[j]].data == data) {
+                    batch_ids[group_count++] = timer_id(batch_slots[j]);
+                }
+            }
+            pthread_mutex_unlock(&timer_lock);
+
+            callback(batch_ids, group_count, data);
+
+            pthread_mutex_lock(&timer_lock);
+            // The callback may have started timers, moving slots. Its work
+            // may also already have re-armed an interval, or cleared it
+            // and reused the slot for a new timer, which isn't ours.
+            for (j = i; j < count; j++) {
+                size_t slot = batch_slots[j];
+                if (slot == NOT_IN_HEAP) {
+                    continue;
+                }
+                if (!slots[slot].active || timer_id(slot) != batch_slot_ids[j]) {
+                    batch_slots[j] = NOT_IN_HEAP;
+                    continue;
+                }
+                if (slots[slot].callback != callback || slots[slot].data != data) {
+                    continue;
+                }
+                batch_slots[j] = NOT_IN_HEAP;
+                struct timer *timer = &slots[slot];
+                // A periodic timer stays running, out of the heap, until
+                // timer_rearm.
+                if (timer->period_millis > 0 && !timer->cancelled) {
+                    continue;
+                }
+                timer->running = false;
+                slot_free(slot);
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool start_thread(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int err = pthread_create(&thread, &thread_attr, timer_thread, NULL);
+    pthread_attr_destroy(&thread_attr);
+    if (err) {
+        pthread_cond_destroy(&timer_cond);
+        return false;
+    }
+    thread_started = true;
+    return true;
+}
+
+unsigned long timer_start(long millis, long period_millis, timer_callback_t callback, void *data) {
+    pthread_mutex_lock(&timer_lock);
+    if (!thread_started && !start_thread()) {
+        pthread_mutex_unlock(&timer_lock);
+        return 0;
+    }
+
+    size_t slot = slot_alloc();
+    if (slot == NOT_IN_HEAP) {
+        pthread_mutex_unlock(&timer_lock);
+        return 0;
+    }
+    struct timer *timer = &slots[slot];
+    timer->generation = (timer->generation + 1) & GENERATION_MASK;
+    if (timer->generation == 0) {
+        timer->generation = 1;
+    }
+    timer->deadline = now_nanos() + (millis > 0 ? (uint64_t) millis * 1000000 : 0);
+    timer->period_millis = period_millis;
+    timer->callback = callback;
+    timer->data = data;
+    timer->active = true;
+    timer->running = false;
+    timer->cancelled = false;
+    if (!heap_push(slot)) {
+        slot_free(slot);
+        pthread_mutex_unlock(&timer_lock);
+        return 0;
+    }
+
+    unsigned long id = timer_id(slot);
+    if (timer->heap_index == 0) {
+        pthread_cond_signal(&timer_cond);
+    }
+    pthread_mutex_unlock(&timer_lock);
+    return id;
+}
+
+bool timer_cancel(unsigned long id) {
+    size_t slot = id & SLOT_MASK;
+    unsigned long generation = id >> SLOT_BITS;
+
+    pthread_mutex_lock(&timer_lock);
+    if (slot >= slot_count || !slots[slot].active || slots[slot].generation != generation
+        || slots[slot].cancelled) {
+        pthread_mutex_unlock(&timer_lock);
+        return false;
+    }
+
+    struct timer *timer = &slots[slot];
+    if (timer->running) {
+        if (timer->period_millis == 0) {
+            pthread_mutex_unlock(&timer_lock);
+            return false;
+        }
+        timer->cancelled = true;
+    } else {
+        heap_remove(timer->heap_index);
+        slot_free(slot);
+    }
+    pthread_mutex_unlock(&timer_lock);
+    return true;
+}
+
+void timer_rearm(unsigned long id) {
+    size_t slot = id & SLOT_MASK;
+    unsigned long generation = id >> SLOT_BITS;
+
+    pthread_mutex_lock(&timer_lock);
+    if (slot >= slot_count || !slots[slot].active || slots[slot].generation != generation
+        || !slots[slot].running || slots[slot].period_millis == 0) {
+        pthread_mutex_unlock(&timer_lock);
+        return;
+    }
+
+    struct timer *timer = &slots[slot];
+    timer->running = false;
+    if (!timer->cancelled) {
+        timer->deadline = now_nanos() + (uint64_t) timer->period_millis * 1000000;
+        if (heap_push(slot)) {
+            if (timer->heap_index == 0) {
+                pthread_cond_signal(&timer_cond);
+            }
+            pthread_mutex_unlock(&timer_lock);
+            return;
+        }
+    }
+    slot_free(slot);
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void timer_set_slack(long millis) {
+    pthread_mutex_lock(&timer_lock);
+    slack_nanos = millis > 0 ? (uint64_t) millis * 1000000 : 0;
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void timer_get_stats(struct timer_stats *out) {
+    pthread_mutex_lock(&timer_lock);
+    *out = stats;
+    out->pending = heap_count;
+    pthread_mutex_unlock(&timer_lock);
+}
@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+// Timers for setTimeout and setInterval, all run from one thread.
+
+// Called with the ids of all the timers sharing callback and data that
+// came due together, earliest first.
+typedef void (*timer_callback_t)(const unsigned long *ids, size_t count, void *data);
+
+// Calls back on the timer thread once millis have passed and then, if
+// period_millis is non-zero, that long after each timer_rearm until
+// cancelled. Returns the timer's id (never 0), or 0 if it couldn't be
+// started.
+unsigned long timer_start(long millis, long period_millis, timer_callback_t callback, void *data);
+
+// Schedules a periodic timer's next tick, once whatever its last tick
+// handed work to has done it, so ticks never pile up behind slow work.
+// Does nothing for a one-shot timer or one that is no longer running.
+void timer_rearm(unsigned long id);
+
+// Returns false if id already fired (one-shot) or was cancelled before.
+// Cancelling a periodic timer between a tick and its timer_rearm stops
+// it repeating.
+bool timer_cancel(unsigned long id);
+
+// Timers due within millis of each other fire in the same batch, the later
+// ones up to millis early.
+void timer_set_slack(long millis);
+
+#define TIMER_BATCH_BUCKETS 8
+
+struct timer_stats {
+    unsigned long batches;
+    unsigned long fired;
+    size_t max_batch;
+    size_t pending;
+    // Batches of 1, 2-3, 4-7, ... timers; the last bucket takes the rest.
+    unsigned long batch_sizes[TIMER_BATCH_BUCKETS];
+};
+
+void timer_get_stats(struct timer_stats *stats);
@@ -0,0 +1,144 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+// Events are kept in memory while tracing and only formatted as JSON when
+// tracing stops, so recording one is a clock read and an append.
+
+#define TRACE_MAX_EVENTS (1 << 20)
+
+struct trace_event {
+    const char *name;
+    char *detail;
+    double ts;
+    int tid;
+    char phase;
+};
+
+volatile bool trace_enabled = false;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_event *events = NULL;
+static size_t event_count = 0;
+static size_t event_capacity = 0;
+static double start_us = 0;
+
+static int next_tid = 0;
+static __thread int thread_tid = 0;
+
+static double now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void trace_free_events(void) {
+    size_t i;
+    for (i = 0; i < event_count; i++) {
+        free(events[i].detail);
+    }
+    free(events);
+    events = NULL;
+    event_count = 0;
+    event_capacity = 0;
+}
+
+void trace_start(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_free_events();
+    start_us = now_us();
+    trace_enabled = true;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void trace_add(const char *name, const char *detail, char phase) {
+    double ts = now_us();
+
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_enabled || event_count == TRACE_MAX_EVENTS) {
+        pthread_mutex_unlock(&trace_lock);
+        return;
+    }
+    if (thread_tid == 0) {
+        thread_tid = ++next_tid;
+    }
+    if (event_count == event_capacity) {
+        size_t capacity = event_capacity ? event_capacity * 2 : 4096;
+        struct trace_event *grown = realloc(events, capacity * sizeof(struct trace_event));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&trace_lock);
+            return;
+        }
+        events = grown;
+        event_capacity = capacity;
+    }
+    struct trace_event *event = &events[event_count++];
+    event->name = name;
+    event->detail = detail ? strdup(detail) : NULL;
+    event->ts = ts - start_us;
+    event->tid = thread_tid;
+    event->phase = phase;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_begin(const char *name, const char *detail) {
+    trace_add(name, detail, 'B');
+}
+
+void trace_end(const char *name) {
+    trace_add(name, NULL, 'E');
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+bool trace_stop(const char *path) {
+    pthread_mutex_lock(&trace_lock);
+    trace_enabled = false;
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        trace_free_events();
+        pthread_mutex_unlock(&trace_lock);
+        return false;
+    }
+
+    fputs("{\"traceEvents\":[\n", f);
+    size_t i;
+    for (i = 0; i < event_count; i++) {
+        struct trace_event *event = &events[i];
+        fputs("{\"name\":", f);
+        write_json_string(f, event->name);
+        fprintf(f, ",\"cat\":\"replete\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                event->phase, event->ts, event->tid);
+        if (event->detail) {
+            fputs(",\"args\":{\"detail\":", f);
+            write_json_string(f, event->detail);
+            fputc('}', f);
+        }
+        fputs(i + 1 < event_count ? "},\n" : "}\n", f);
+    }
+    fputs("],\"displayTimeUnit\":\"ms\"}\n", f);
+
+    bool ok = fclose(f) == 0;
+    trace_free_events();
+    pthread_mutex_unlock(&trace_lock);
+    return ok;
+}
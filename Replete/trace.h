@@ -0,0 +1,23 @@
+#include <stdbool.h>
+
+// Span tracing for startup and loading, written out in the Chrome
+// trace-event format (chrome://tracing, Perfetto, Speedscope). Off unless
+// trace_start has been called; the macros then cost a test of
+// trace_enabled.
+
+extern volatile bool trace_enabled;
+
+void trace_start(void);
+
+// Stops tracing and writes what was recorded to path. Returns false if the
+// file couldn't be written.
+bool trace_stop(const char *path);
+
+// name must be a string literal; detail (a path, a namespace) is copied
+// and may be NULL.
+void trace_begin(const char *name, const char *detail);
+
+void trace_end(const char *name);
+
+#define TRACE_BEGIN(name, detail) do { if (trace_enabled) trace_begin(name, detail); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_end(name); } while (0)
@@ -0,0 +1,114 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "watchdog.h"
+
+// JavaScriptCore can call back periodically while a script runs and stop
+// it if asked to, but only through its private JSContextRefPrivate.h. The
+// callback is armed with a short poll interval rather than the budget
+// itself, so an interrupt takes effect promptly; each poll that finds the
+// task within budget returns false, which rearms it.
+
+typedef bool (*JSShouldTerminateCallback)(JSContextRef ctx, void *context);
+
+JS_EXPORT void JSContextGroupSetExecutionTimeLimit(JSContextGroupRef group, double limit,
+                                                   JSShouldTerminateCallback callback,
+                                                   void *context) __attribute__((weak));
+
+#define WATCHDOG_POLL_SECONDS 0.1
+#define WATCHDOG_DEFAULT_LIMIT_SECONDS 30
+
+static pthread_mutex_t watchdog_lock = PTHREAD_MUTEX_INITIALIZER;
+static double limit_seconds = WATCHDOG_DEFAULT_LIMIT_SECONDS;
+
+// Only touched with watchdog_lock held.
+static int depth = 0;
+static uint64_t deadline = 0;
+static bool interrupt_requested = false;
+static enum watchdog_reason reason = WATCHDOG_NONE;
+
+static uint64_t now_nanos(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// With watchdog_lock held.
+static void update_reason(void) {
+    if (depth > 0 && reason == WATCHDOG_NONE) {
+        if (interrupt_requested) {
+            reason = WATCHDOG_INTERRUPTED;
+        } else if (deadline && now_nanos() >= deadline) {
+            reason = WATCHDOG_TIMED_OUT;
+        }
+    }
+}
+
+static bool should_terminate(JSContextRef ctx, void *context) {
+    pthread_mutex_lock(&watchdog_lock);
+    update_reason();
+    // Once terminated, every poll until the script has unwound says so.
+    bool terminate = depth > 0 && reason != WATCHDOG_NONE;
+    pthread_mutex_unlock(&watchdog_lock);
+    return terminate;
+}
+
+bool watchdog_install(JSContextRef ctx) {
+    if (JSContextGroupSetExecutionTimeLimit == NULL) {
+        return false;
+    }
+    JSContextGroupSetExecutionTimeLimit(JSContextGetGroup(ctx), WATCHDOG_POLL_SECONDS, should_terminate, NULL);
+    return true;
+}
+
+void watchdog_set_limit(double seconds) {
+    pthread_mutex_lock(&watchdog_lock);
+    limit_seconds = seconds > 0 ? seconds : 0;
+    pthread_mutex_unlock(&watchdog_lock);
+}
+
+double watchdog_get_limit(void) {
+    pthread_mutex_lock(&watchdog_lock);
+    double seconds = limit_seconds;
+    pthread_mutex_unlock(&watchdog_lock);
+    return seconds;
+}
+
+void watchdog_begin(void) {
+    pthread_mutex_lock(&watchdog_lock);
+    if (depth++ == 0) {
+        deadline = limit_seconds > 0 ? now_nanos() + (uint64_t) (limit_seconds * 1e9) : 0;
+        interrupt_requested = false;
+        reason = WATCHDOG_NONE;
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+}
+
+enum watchdog_reason watchdog_end(void) {
+    pthread_mutex_lock(&watchdog_lock);
+    enum watchdog_reason result = reason;
+    if (--depth == 0) {
+        deadline = 0;
+        interrupt_requested = false;
+        reason = WATCHDOG_NONE;
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+    return result;
+}
+
+enum watchdog_reason watchdog_check(void) {
+    pthread_mutex_lock(&watchdog_lock);
+    update_reason();
+    enum watchdog_reason result = reason;
+    pthread_mutex_unlock(&watchdog_lock);
+    return result;
+}
+
+void watchdog_interrupt(void) {
+    pthread_mutex_lock(&watchdog_lock);
+    if (depth > 0) {
+        interrupt_requested = true;
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+}
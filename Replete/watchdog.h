@@ -0,0 +1,40 @@
+#include <stdbool.h>
+
+#include <JavaScriptCore/JavaScript.h>
+
+// Bounds how long one task on the JS thread may run. A task that overruns
+// its budget, or is interrupted from another thread, is terminated: the
+// script unwinds with an exception JS can't catch, and the context stays
+// usable for whatever is queued next.
+
+enum watchdog_reason {
+    WATCHDOG_NONE,
+    WATCHDOG_TIMED_OUT,
+    WATCHDOG_INTERRUPTED
+};
+
+// Hooks the watchdog into ctx's context group. Returns false if this
+// JavaScriptCore can't terminate scripts, in which case the rest of the
+// API is harmless but has no effect.
+bool watchdog_install(JSContextRef ctx);
+
+// The budget watchdog_begin gives each task; 0 means no limit.
+void watchdog_set_limit(double seconds);
+
+double watchdog_get_limit(void);
+
+// JS thread only. Brackets a task; nested calls extend the outermost one.
+void watchdog_begin(void);
+
+// Returns why the task was terminated, if it was.
+enum watchdog_reason watchdog_end(void);
+
+// JS thread only, between calls into JS within a task. Says whether the
+// task should stop now, having overrun or been interrupted. JavaScriptCore
+// times each call on its own, so only this catches a task that runs long
+// as many short calls.
+enum watchdog_reason watchdog_check(void);
+
+// Safe from any thread. Terminates the current task, if any, within a
+// tenth of a second or so.
+void watchdog_interrupt(void);